@@ -1,45 +1,1806 @@
+#include <QAction>
 #include <QApplication>
-#include <QCryptographicHash>
+#include <QCommandLineParser>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QFileSystemWatcher>
-#include <QGraphicsPixmapItem>
+#include <QGraphicsItem>
 #include <QGraphicsView>
+#include <QHash>
 #include <QLoggingCategory>
+#include <QPainter>
 #include <QScrollBar>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QStyleOptionGraphicsItem>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
 #include <QtLogging>
 #include <QtWidgets/QMainWindow>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include <unistd.h>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "wuffs-unsupported-snapshot.cc"
 
-namespace {
-    const auto cat = QLoggingCategory("img-viewer");
+namespace {
+    const auto cat = QLoggingCategory("img-viewer");
+
+    template<typename Fn>
+    class Defer {
+    public:
+        explicit Defer(Fn fn) : m_fn(std::move(fn)) {}
+
+        Defer(const Defer &) = delete;
+
+        Defer(Defer &&) = delete;
+
+        Defer &operator=(const Defer &) = delete;
+
+        Defer &operator=(Defer &&) = delete;
+
+        ~Defer() noexcept(false) { m_fn(); }
+
+    private:
+        Fn m_fn;
+    };
+
+    // Range of 16-bit samples that is stretched over the 8-bit display range
+    struct SampleWindow {
+        int low = 0;
+        int high = 0xffff;
+
+        [[nodiscard]] SampleWindow shifted(int eighths) const {
+            const auto step = std::max(1, (high - low) / 8) * eighths;
+            const auto by = std::clamp(step, -low, 0xffff - high);
+            return {low + by, high + by};
+        }
+
+        [[nodiscard]] SampleWindow scaled(double factor) const {
+            const auto centre = (low + high) / 2;
+            const auto half = std::clamp(static_cast<int>((high - low) * factor / 2), 1, 0x8000);
+            return {std::max(0, centre - half), std::min(0xffff, centre + half)};
+        }
+
+        bool operator!=(const SampleWindow &other) const {
+            return low != other.low || high != other.high;
+        }
+    };
+
+    struct DecodeOptions {
+        bool ignoreChecksum = false;
+        // Decode 16-bit PNGs at full depth and window them for display
+        bool keepDeepSamples = false;
+        SampleWindow window;
+    };
+
+    // A frame kept at 16 bits per channel. Samples are little-endian, four-channel frames are in B, G, R, A order.
+    struct DeepFrame {
+        QSize size;
+        int channels = 0;
+        bool opaque = false;
+        std::shared_ptr<uint16_t[]> samples;
+
+        [[nodiscard]] bool isNull() const {
+            return !samples;
+        }
+
+        [[nodiscard]] int64_t sizeInBytes() const {
+            return isNull() ? 0 : int64_t{size.width()} * size.height() * channels * 2;
+        }
+    };
+
+    // Channels of a format that DeepFrame can hold, 0 for any other format
+    int deep_channels(wuffs_base__pixel_format pixfmt) {
+        switch (pixfmt.repr) {
+            case WUFFS_BASE__PIXEL_FORMAT__Y_16LE: return 1;
+            case WUFFS_BASE__PIXEL_FORMAT__BGRA_NONPREMUL_4X16LE: return 4;
+            default: return 0;
+        }
+    }
+
+    // Opaque grayscale keeps its single byte per pixel, everything else is swizzled to 32-bit BGRA. With
+    // keepDeepSamples, 16-bit images stay in the decoder's own 16-bit format.
+    wuffs_base__pixel_format select_pixfmt(const wuffs_base__image_config &imageConfig, bool keepDeepSamples = false) {
+        if (keepDeepSamples && deep_channels(imageConfig.pixcfg.pixel_format())) {
+            return imageConfig.pixcfg.pixel_format();
+        }
+        if (imageConfig.first_frame_is_opaque()
+            && imageConfig.pixcfg.pixel_format().repr == WUFFS_BASE__PIXEL_FORMAT__Y) {
+            return wuffs_base__make_pixel_format(WUFFS_BASE__PIXEL_FORMAT__Y);
+        }
+        return wuffs_base__make_pixel_format(WUFFS_BASE__PIXEL_FORMAT__BGRA_PREMUL);
+    }
+
+    // Opaque BGRA_PREMUL has every alpha byte at 0xff, which is exactly RGB32 and lets Qt paint it with
+    // plain copies instead of blends
+    QImage::Format qimage_format(const wuffs_base__image_config &imageConfig) {
+        switch (imageConfig.pixcfg.pixel_format().repr) {
+            case WUFFS_BASE__PIXEL_FORMAT__Y: return QImage::Format_Grayscale8;
+            case WUFFS_BASE__PIXEL_FORMAT__BGRA_PREMUL:
+                return imageConfig.first_frame_is_opaque() ? QImage::Format_RGB32
+                                                           : QImage::Format_ARGB32_Premultiplied;
+            default: return QImage::Format_Invalid;
+        }
+    }
+
+    // Transparent where the format has alpha, black otherwise
+    void clear_frame(QImage &image) {
+        image.fill(image.hasAlphaChannel() ? Qt::transparent : Qt::black);
+    }
+
+    // Clears the rows from top down, in place
+    void clear_rows(QImage &image, int top) {
+        if (top >= image.height()) return;
+        auto rows = QImage(image.scanLine(top), image.width(), image.height() - top, image.bytesPerLine(),
+                           image.format());
+        clear_frame(rows);
+    }
+
+    // Copies the pixels of from into to, which must match it in size and format, without sharing either
+    void copy_frame(const QImage &from, QImage &to) {
+        const auto rowBytes = static_cast<size_t>(std::min(from.bytesPerLine(), to.bytesPerLine()));
+        for (int y = 0; y < from.height(); ++y) std::memcpy(to.scanLine(y), from.constScanLine(y), rowBytes);
+    }
+
+    // Allocations carried over between decodes of the same file. Only touched by the single decode in flight
+    // for its ImgState, or by the GUI thread while none is.
+    struct BufferPool {
+        // The frame that was on screen before the last swap
+        QImage spareFrame;
+        std::unique_ptr<uint8_t[]> workbuf;
+        size_t workbufLen = 0;
+        // Re-initialized rather than re-allocated for each decode of the file
+        wuffs_png__decoder::unique_ptr pngDecoder{nullptr};
+
+        // Counts since the last takeCounts
+        size_t reused = 0;
+        size_t allocated = 0;
+        size_t totalReused = 0;
+
+        // Allocations avoided and made since the last call
+        std::pair<size_t, size_t> takeCounts() {
+            totalReused += reused;
+            return {std::exchange(reused, 0), std::exchange(allocated, 0)};
+        }
+
+        // nullptr on allocation failure
+        wuffs_png__decoder::unique_ptr acquirePngDecoder() {
+            if (pngDecoder) {
+                // Only a fresh allocation is known to be all zeroes, so WUFFS_INITIALIZE__ALREADY_ZEROED is out.
+                // Leaving the internal buffers (mostly zlib history and Huffman tables) dirty is still memory-safe.
+                const auto status = pngDecoder->initialize(sizeof__wuffs_png__decoder(), WUFFS_VERSION,
+                                                           WUFFS_INITIALIZE__LEAVE_INTERNAL_BUFFERS_UNINITIALIZED);
+                if (status.is_ok()) {
+                    ++reused;
+                    return std::move(pngDecoder);
+                }
+                pngDecoder.reset();
+            }
+            ++allocated;
+            // Zeroed by calloc and initialized with WUFFS_INITIALIZE__ALREADY_ZEROED
+            return wuffs_png__decoder::alloc();
+        }
+
+        void releasePngDecoder(wuffs_png__decoder::unique_ptr decoder) {
+            pngDecoder = std::move(decoder);
+        }
+
+        // Frees what is kept around for the next decode
+        void clear() {
+            spareFrame = QImage();
+            releaseWorkbuf();
+            pngDecoder.reset();
+        }
+
+        // About as large as the frame, so only kept for files that have refreshed once already
+        void releaseWorkbuf() {
+            workbuf.reset();
+            workbufLen = 0;
+        }
+
+        [[nodiscard]] int64_t sizeInBytes() const {
+            return spareFrame.sizeInBytes() + static_cast<int64_t>(workbufLen)
+                   + (pngDecoder ? static_cast<int64_t>(sizeof__wuffs_png__decoder()) : 0);
+        }
+
+        // The spare frame if it fits, otherwise a new uninitialized one
+        QImage acquireFrame(const QSize &size, QImage::Format format, bool &recycled) {
+            recycled = spareFrame.size() == size && spareFrame.format() == format && spareFrame.isDetached();
+            ++(recycled ? reused : allocated);
+            return recycled ? std::move(spareFrame) : QImage(size, format);
+        }
+
+        // Empty on allocation failure
+        wuffs_base__slice_u8 acquireWorkbuf(wuffs_base__range_ii_u64 lenRange) {
+            if (workbufLen < lenRange.min_incl) {
+                workbuf.reset();
+                workbufLen = 0;
+                if (lenRange.max_incl > SIZE_MAX) return wuffs_base__empty_slice_u8();
+                workbuf.reset(new(std::nothrow) uint8_t[lenRange.max_incl]);
+                if (!workbuf) return wuffs_base__empty_slice_u8();
+                workbufLen = static_cast<size_t>(lenRange.max_incl);
+                ++allocated;
+            } else if (workbufLen > 0) {
+                ++reused;
+            }
+            const auto len = std::min<uint64_t>(workbufLen, lenRange.max_incl);
+            return wuffs_base__make_slice_u8(workbuf.get(), static_cast<size_t>(len));
+        }
+    };
+
+    // Maps a deep frame to 8 bits per channel through window. Alpha is only narrowed.
+    QImage apply_window(const DeepFrame &frame, SampleWindow window) {
+        const auto format = frame.channels == 1 ? QImage::Format_Grayscale8
+                            : frame.opaque ? QImage::Format_RGB32 : QImage::Format_ARGB32;
+        auto image = QImage(frame.size, format);
+        if (frame.isNull() || image.isNull()) return {};
+
+        // out = (min(v - low, range) * scale) * factor >> 16, where scale is the power of two that stretches range
+        // closest to 16 bits so factor keeps the precision of a 16 to 8 bit lookup table
+        struct Lane {
+            uint16_t low, range, scale, factor;
+        };
+        const auto makeLane = [](int low, int high) {
+            const auto range = static_cast<uint32_t>(std::max(1, high - low));
+            uint32_t scale = 1;
+            while (range * scale * 2 <= 0xffff) scale *= 2;
+            const auto stretched = range * scale;
+            return Lane{static_cast<uint16_t>(low), static_cast<uint16_t>(range), static_cast<uint16_t>(scale),
+                        static_cast<uint16_t>((255u * 65536u + stretched - 1) / stretched)};
+        };
+        const auto colour = makeLane(window.low, window.high);
+        const Lane lanes[4] = {colour, colour, colour, frame.channels == 4 ? makeLane(0, 0xffff) : colour};
+
+        const auto rowSamples = static_cast<size_t>(frame.size.width()) * frame.channels;
+        for (int y = 0; y < frame.size.height(); ++y) {
+            const auto *in = frame.samples.get() + y * rowSamples;
+            auto *out = image.scanLine(y);
+            size_t i = 0;
+#if defined(__SSE2__)
+            const auto laneVector = [&](uint16_t Lane::*field) {
+                return _mm_setr_epi16(static_cast<short>(lanes[0].*field), static_cast<short>(lanes[1].*field),
+                                      static_cast<short>(lanes[2].*field), static_cast<short>(lanes[3].*field),
+                                      static_cast<short>(lanes[0].*field), static_cast<short>(lanes[1].*field),
+                                      static_cast<short>(lanes[2].*field), static_cast<short>(lanes[3].*field));
+            };
+            const auto low = laneVector(&Lane::low);
+            const auto range = laneVector(&Lane::range);
+            const auto scale = laneVector(&Lane::scale);
+            const auto factor = laneVector(&Lane::factor);
+            const auto map = [&](__m128i v) {
+                auto offset = _mm_subs_epu16(v, low);
+                offset = _mm_sub_epi16(offset, _mm_subs_epu16(offset, range));
+                return _mm_mulhi_epu16(_mm_mullo_epi16(offset, scale), factor);
+            };
+            for (; i + 16 <= rowSamples; i += 16) {
+                const auto first = map(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+                const auto second = map(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 8)));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(first, second));
+            }
+#endif
+            for (; i < rowSamples; ++i) {
+                const auto &lane = lanes[i % 4];
+                const auto offset = std::min<uint32_t>(in[i] - std::min(in[i], lane.low), lane.range);
+                out[i] = static_cast<uchar>((offset * lane.scale * lane.factor) >> 16);
+            }
+        }
+        return image;
+    }
+
+    // Points pixbuf at the bits of image, which must match pixcfg in size and format
+    wuffs_base__status bind_pixbuf(wuffs_base__pixel_buffer &pixbuf, const wuffs_base__pixel_config &pixcfg,
+                                   QImage &image) {
+        auto pixfmt = pixcfg.pixel_format();
+        const auto bytesPerPixel = pixfmt.bits_per_pixel() / 8;
+        return pixbuf.set_interleaved(&pixcfg,
+                                      wuffs_base__make_table_u8(image.bits(),
+                                                                pixcfg.width() * bytesPerPixel,
+                                                                pixcfg.height(),
+                                                                image.bytesPerLine()),
+                                      wuffs_base__empty_slice_u8());
+    }
+
+    // Hands wuffs the bits of a QImage as its pixel buffer, so the decoded frame can be painted without a copy.
+    // The QImage, or the DeepFrame for 16-bit formats, is owned by the result's pixbuf_mem_owner until
+    // take_frame moves it out.
+    class QImageCallbacks : public wuffs_aux::DecodeImageCallbacks {
+    public:
+        explicit QImageCallbacks(BufferPool *buffers = nullptr, const DecodeOptions &options = {})
+                : m_buffers{buffers}, m_ignoreChecksum{options.ignoreChecksum},
+                  m_keepDeepSamples{options.keepDeepSamples} {}
+
+        wuffs_base__image_decoder::unique_ptr SelectDecoder(uint32_t fourcc,
+                                                            wuffs_base__slice_u8 prefixData,
+                                                            bool prefixClosed) override {
+            auto decoder = wuffs_base__image_decoder::unique_ptr(nullptr);
+            if (m_buffers && fourcc == WUFFS_BASE__FOURCC__PNG) {
+                auto png = m_buffers->acquirePngDecoder();
+                m_pooledDecoder = png != nullptr;
+                if (png) decoder.reset(png.release()->upcast_as__wuffs_base__image_decoder());
+            } else {
+                decoder = DecodeImageCallbacks::SelectDecoder(fourcc, prefixData, prefixClosed);
+            }
+            // The stock PNG decoder always skips checksums, make the choice explicit for every format
+            if (decoder) decoder->set_quirk(WUFFS_BASE__QUIRK_IGNORE_CHECKSUM, m_ignoreChecksum ? 1 : 0);
+            return decoder;
+        }
+
+        void Done(wuffs_aux::DecodeImageResult &, wuffs_aux::sync_io::Input &, wuffs_aux::IOBuffer &,
+                  wuffs_base__image_decoder::unique_ptr imageDecoder) override {
+            if (m_pooledDecoder && imageDecoder) {
+                // Came from acquirePngDecoder, so this undoes the upcast
+                m_buffers->releasePngDecoder(
+                        wuffs_png__decoder::unique_ptr(reinterpret_cast<wuffs_png__decoder *>(imageDecoder.release())));
+            }
+        }
+
+        wuffs_base__pixel_format SelectPixfmt(const wuffs_base__image_config &imageConfig) override {
+            return select_pixfmt(imageConfig, m_keepDeepSamples);
+        }
+
+        AllocPixbufResult AllocPixbuf(const wuffs_base__image_config &imageConfig,
+                                      bool allowUninitializedMemory) override {
+            if (deep_channels(imageConfig.pixcfg.pixel_format())) {
+                return allocDeepPixbuf(imageConfig, allowUninitializedMemory);
+            }
+
+            const auto format = qimage_format(imageConfig);
+            if (format == QImage::Format_Invalid) {
+                qWarning(cat) << "Unknown pixfmt" << std::hex << imageConfig.pixcfg.pixel_format().repr;
+                return {wuffs_aux::DecodeImage_UnsupportedPixelFormat};
+            }
+
+            const auto size = QSize(static_cast<int>(imageConfig.pixcfg.width()),
+                                    static_cast<int>(imageConfig.pixcfg.height()));
+            bool recycled = false;
+            auto image = wuffs_aux::MemOwner(new QImage(m_buffers ? m_buffers->acquireFrame(size, format, recycled)
+                                                                  : QImage(size, format)),
+                                             [](void *ptr) noexcept { delete static_cast<QImage *>(ptr); });
+            auto &qimage = *static_cast<QImage *>(image.get());
+            if (qimage.isNull()) return {wuffs_aux::DecodeImage_OutOfMemory};
+            // A recycled frame is fully overwritten by the SRC blend, clearing it would only cost a memset
+            if (!allowUninitializedMemory && !recycled) clear_frame(qimage);
+
+            wuffs_base__pixel_buffer pixbuf;
+            const auto status = bind_pixbuf(pixbuf, imageConfig.pixcfg, qimage);
+            if (!status.is_ok()) return {status.message()};
+            return {std::move(image), pixbuf};
+        }
+
+        AllocWorkbufResult AllocWorkbuf(wuffs_base__range_ii_u64 lenRange, bool allowUninitializedMemory) override {
+            if (!m_buffers) return DecodeImageCallbacks::AllocWorkbuf(lenRange, allowUninitializedMemory);
+
+            const auto workbuf = m_buffers->acquireWorkbuf(lenRange);
+            if (workbuf.len < lenRange.min_incl) return {wuffs_aux::DecodeImage_OutOfMemory};
+            // The pool keeps ownership, so DecodeImage gets a non-owning MemOwner
+            return {wuffs_aux::MemOwner(nullptr, &free), workbuf};
+        }
+
+    private:
+        AllocPixbufResult allocDeepPixbuf(const wuffs_base__image_config &imageConfig, bool allowUninitializedMemory) {
+            const auto &pixcfg = imageConfig.pixcfg;
+            auto frame = wuffs_aux::MemOwner(new DeepFrame(),
+                                             [](void *ptr) noexcept { delete static_cast<DeepFrame *>(ptr); });
+            auto &deep = *static_cast<DeepFrame *>(frame.get());
+            deep.size = QSize(static_cast<int>(pixcfg.width()), static_cast<int>(pixcfg.height()));
+            deep.channels = deep_channels(pixcfg.pixel_format());
+            deep.opaque = imageConfig.first_frame_is_opaque();
+            const auto rowSamples = static_cast<size_t>(pixcfg.width()) * deep.channels;
+            const auto count = rowSamples * pixcfg.height();
+            deep.samples.reset(allowUninitializedMemory ? new(std::nothrow) uint16_t[count]
+                                                        : new(std::nothrow) uint16_t[count]());
+            if (deep.isNull()) return {wuffs_aux::DecodeImage_OutOfMemory};
+
+            wuffs_base__pixel_buffer pixbuf;
+            const auto rowBytes = rowSamples * sizeof(uint16_t);
+            const auto status = pixbuf.set_interleaved(
+                    &pixcfg,
+                    wuffs_base__make_table_u8(reinterpret_cast<uint8_t *>(deep.samples.get()), rowBytes,
+                                              pixcfg.height(), rowBytes),
+                    wuffs_base__empty_slice_u8());
+            if (!status.is_ok()) return {status.message()};
+            return {std::move(frame), pixbuf};
+        }
+
+        BufferPool *m_buffers;
+        bool m_ignoreChecksum;
+        bool m_keepDeepSamples;
+        bool m_pooledDecoder = false;
+    };
+
+    // Decoder for a PNG that is still being written. Bytes are fed as the file grows and the wuffs coroutine
+    // resumes where it suspended, so nothing that was already consumed is read or inflated again.
+    class StreamingDecode {
+    public:
+        enum class Progress { NeedMore, Complete, Failed };
+
+        StreamingDecode(BufferPool &buffers, bool ignoreChecksum)
+                : m_buffers{buffers}, m_decoder{buffers.acquirePngDecoder()} {
+            if (m_decoder) m_decoder->set_quirk(WUFFS_BASE__QUIRK_IGNORE_CHECKSUM, ignoreChecksum ? 1 : 0);
+        }
+
+        StreamingDecode(const StreamingDecode &) = delete;
+
+        StreamingDecode &operator=(const StreamingDecode &) = delete;
+
+        ~StreamingDecode() {
+            if (m_decoder) m_buffers.releasePngDecoder(std::move(m_decoder));
+        }
+
+        // Whether data, the whole file as it is now, extends the bytes consumed so far. A file truncated and
+        // written again between two looks keeps its header, but is unlikely to match where decoding stopped.
+        [[nodiscard]] bool continues(const uint8_t *data, size_t len) const {
+            return len >= m_consumed && len >= m_header.size()
+                   && std::equal(m_header.begin(), m_header.end(), data)
+                   && std::equal(m_tail.begin(), m_tail.end(), data + m_consumed - m_tail.size());
+        }
+
+        // Set once the header shows 16-bit samples, which this decoder narrows to 8 bits
+        [[nodiscard]] bool hasDeepSource() const {
+            return m_deepSource;
+        }
+
+        [[nodiscard]] uint64_t consumed() const {
+            return m_consumed;
+        }
+
+        // Held on top of the pooled buffers: the frame being decoded and the scratch state for previews
+        [[nodiscard]] int64_t sizeInBytes() const {
+            return m_image.sizeInBytes() + static_cast<int64_t>(m_scratchWorkbuf.capacity())
+                   + (m_scratch ? static_cast<int64_t>(sizeof__wuffs_png__decoder()) : 0);
+        }
+
+        Progress feed(const uint8_t *data, size_t len) {
+            if (!m_decoder || m_stage == Stage::Failed) return Progress::Failed;
+            if (m_header.empty()) {
+                // Signature and IHDR, enough to tell a rewritten file from a growing one
+                m_header.assign(data, data + std::min<size_t>(len, 33));
+            }
+
+            auto src = wuffs_base__ptr_u8__reader(const_cast<uint8_t *>(data) + m_consumed, len - m_consumed, false);
+            src.meta.pos = m_consumed;
+            const auto advance = Defer{[&] {
+                m_consumed = src.meta.pos + src.meta.ri;
+                const auto tail = std::min<uint64_t>(m_consumed, kTailBytes);
+                m_tail.assign(data + m_consumed - tail, data + m_consumed);
+            }};
+
+            if (m_stage == Stage::ImageConfig) {
+                const auto status = m_decoder->decode_image_config(&m_imageConfig, &src);
+                if (status.is_suspension()) return Progress::NeedMore;
+                if (!status.is_ok()) return fail(status);
+
+                const auto width = m_imageConfig.pixcfg.width();
+                const auto height = m_imageConfig.pixcfg.height();
+                m_deepSource = deep_channels(m_imageConfig.pixcfg.pixel_format()) != 0;
+                m_imageConfig.pixcfg.set(select_pixfmt(m_imageConfig).repr,
+                                         WUFFS_BASE__PIXEL_SUBSAMPLING__NONE, width, height);
+                bool recycled = false;
+                m_image = m_buffers.acquireFrame(QSize(static_cast<int>(width), static_cast<int>(height)),
+                                               qimage_format(m_imageConfig), recycled);
+                // Only handed out once complete, previews draw into frames of their own
+                if (m_image.isNull()) return fail(wuffs_aux::DecodeImage_OutOfMemory);
+                // Previews of interlaced frames start from this one, so pixels no pass reached yet must be blank
+                if (m_decoder->private_impl.f_interlace_pass != 0) clear_frame(m_image);
+
+                const auto workbufLen = m_decoder->workbuf_len();
+                m_workbuf = m_buffers.acquireWorkbuf(workbufLen);
+                if (m_workbuf.len < workbufLen.min_incl) return fail(wuffs_aux::DecodeImage_OutOfMemory);
+                m_stage = Stage::FrameConfig;
+            }
+
+            if (m_stage == Stage::FrameConfig) {
+                const auto status = m_decoder->decode_frame_config(nullptr, &src);
+                if (status.is_suspension()) return Progress::NeedMore;
+                if (!status.is_ok()) return fail(status);
+                m_stage = Stage::Frame;
+            }
+
+            if (m_stage == Stage::Frame) {
+                wuffs_base__pixel_buffer pixbuf;
+                if (const auto status = bind_pixbuf(pixbuf, m_imageConfig.pixcfg, m_image); !status.is_ok()) {
+                    return fail(status);
+                }
+                const auto status = m_decoder->decode_frame(&pixbuf, &src, WUFFS_BASE__PIXEL_BLEND__SRC,
+                                                            m_workbuf, nullptr);
+                if (status.is_suspension()) return Progress::NeedMore;
+                if (!status.is_ok()) return fail(status);
+                m_stage = Stage::Done;
+            }
+
+            return Progress::Complete;
+        }
+
+        // The frame with every row that can be reconstructed from the bytes consumed so far. Wuffs only filters
+        // and swizzles rows once the input ends, so this runs a throwaway copy of the decoder against a closed
+        // input, leaving the suspended original untouched. changed receives the rows that differ from the
+        // previous preview, or a null rect when that is unknown.
+        QImage preview(QRect &changed) {
+            changed = {};
+            // Nothing writes to a finished frame any more, so it can be shared
+            if (m_stage == Stage::Done) return m_image;
+            if (m_stage != Stage::Frame) return {};
+
+            const auto rows = inflatedRows();
+            if (rows >= 0 && m_previewedRows >= 0) {
+                // The row being inflated may have been partially drawn last time
+                const auto top = std::max(0, m_previewedRows - 1);
+                changed = QRect(0, top, m_image.width(), std::min(rows + 1, m_image.height()) - top);
+            }
+            m_previewedRows = rows;
+
+            if (!m_scratch) m_scratch = wuffs_png__decoder::alloc();
+            if (!m_scratch) return {};
+            std::memcpy(static_cast<void *>(m_scratch.get()), m_decoder.get(), sizeof__wuffs_png__decoder());
+
+            // Only the inflated bytes of the current pass are read by the filter; wuffs offers no accessor for it
+            const auto written = std::min<uint64_t>(m_decoder->private_impl.f_workbuf_wi, m_workbuf.len);
+            if (m_scratchWorkbuf.size() < m_workbuf.len) m_scratchWorkbuf.resize(m_workbuf.len);
+            std::memcpy(m_scratchWorkbuf.data(), m_workbuf.ptr, static_cast<size_t>(written));
+
+            // Drawn into a frame of its own. The previous preview may still be on screen, and m_image must stay
+            // unshared, as binding a shared frame for the next feed would copy it.
+            bool recycled = false;
+            auto frame = m_buffers.acquireFrame(m_image.size(), m_image.format(), recycled);
+            if (frame.isNull()) return {};
+            if (rows >= 0) {
+                clear_rows(frame, rows);
+            } else {
+                // The scratch decode only draws the current pass, over the ones already complete in m_image
+                copy_frame(m_image, frame);
+            }
+
+            wuffs_base__pixel_buffer pixbuf;
+            if (!bind_pixbuf(pixbuf, m_imageConfig.pixcfg, frame).is_ok()) return {};
+            uint8_t none = 0;
+            auto closed = wuffs_base__ptr_u8__reader(&none, 0, true);
+            // Expected to end with a truncated input error once the available rows are written
+            m_scratch->decode_frame(&pixbuf, &closed, WUFFS_BASE__PIXEL_BLEND__SRC,
+                                    wuffs_base__make_slice_u8(m_scratchWorkbuf.data(), m_workbuf.len), nullptr);
+            return frame;
+        }
+
+        QImage takeImage() {
+            return std::move(m_image);
+        }
+
+    private:
+        enum class Stage { ImageConfig, FrameConfig, Frame, Done, Failed };
+
+        // Compressed bytes ending at m_consumed that a resumed file must still hold
+        static constexpr uint64_t kTailBytes = 64;
+
+        // Rows of a non-interlaced frame whose bytes have all been inflated, or -1 for interlaced frames. Like
+        // the workbuf length in preview, this is only reachable through the decoder's private state.
+        [[nodiscard]] int inflatedRows() const {
+            const auto &impl = m_decoder->private_impl;
+            if (impl.f_interlace_pass != 0) return -1;
+            return static_cast<int>(impl.f_workbuf_wi / (1 + impl.f_pass_bytes_per_row));
+        }
+
+        Progress fail(const char *message) {
+            qInfo(cat) << "Streaming decode failed:" << message;
+            m_stage = Stage::Failed;
+            return Progress::Failed;
+        }
+
+        Progress fail(const wuffs_base__status &status) {
+            return fail(status.message());
+        }
+
+        BufferPool &m_buffers;
+        wuffs_png__decoder::unique_ptr m_decoder;
+        wuffs_png__decoder::unique_ptr m_scratch{nullptr};
+        std::vector<uint8_t> m_header;
+        std::vector<uint8_t> m_tail;
+        uint64_t m_consumed = 0;
+        int m_previewedRows = -1;
+        bool m_deepSource = false;
+        Stage m_stage = Stage::ImageConfig;
+        wuffs_base__image_config m_imageConfig = wuffs_base__null_image_config();
+        QImage m_image;
+        wuffs_base__slice_u8 m_workbuf = wuffs_base__empty_slice_u8();
+        std::vector<uint8_t> m_scratchWorkbuf;
+    };
+
+    // What checksum verification costs per byte, measured once by running the CRC-32 and Adler-32 that wuffs
+    // verifies over the bytes of the first PNG decoded: every chunk, and the inflated image data
+    struct ChecksumCost {
+        std::once_flag measured;
+        double crcNanosPerByte = 0;
+        double adlerNanosPerByte = 0;
+    };
+
+    ChecksumCost checksumCost;
+
+    // The bytes a PNG inflates to, going by its IHDR and leaving out the few extra filter bytes of interlaced
+    // passes. 0 for anything else.
+    uint64_t png_inflated_size(const uint8_t *ptr, size_t len) {
+        if (len < 33 || std::memcmp(ptr, "\x89PNG\r\n\x1A\n", 8) != 0 || std::memcmp(ptr + 12, "IHDR", 4) != 0) {
+            return 0;
+        }
+        static constexpr uint64_t channels[7] = {1, 0, 3, 1, 2, 0, 4};
+        const auto width = uint64_t{wuffs_base__peek_u32be__no_bounds_check(ptr + 16)};
+        const auto height = uint64_t{wuffs_base__peek_u32be__no_bounds_check(ptr + 20)};
+        const auto depth = uint64_t{ptr[24]};
+        const auto colourType = ptr[25];
+        if (colourType > 6 || channels[colourType] == 0) return 0;
+        return height * (1 + (width * channels[colourType] * depth + 7) / 8);
+    }
+
+    // The time verifying the checksums of a PNG takes or would take, nullopt for other formats
+    std::optional<double> checksum_nanos(const uint8_t *ptr, size_t len) {
+        const auto inflated = png_inflated_size(ptr, len);
+        if (inflated == 0) return std::nullopt;
+        std::call_once(checksumCost.measured, [&] {
+            const auto crc = wuffs_crc32__ieee_hasher::alloc();
+            const auto adler = wuffs_adler32__hasher::alloc();
+            if (!crc || !adler) return;
+            auto *bytes = const_cast<uint8_t *>(ptr);
+            QElapsedTimer timer;
+            timer.start();
+            crc->update_u32(wuffs_base__make_slice_u8(bytes, len));
+            checksumCost.crcNanosPerByte = static_cast<double>(timer.nsecsElapsed()) / static_cast<double>(len);
+            // Adler-32 takes as long whatever the bytes, so the file stands in for the inflated data
+            timer.restart();
+            for (auto left = inflated; left > 0;) {
+                const auto chunk = static_cast<size_t>(std::min<uint64_t>(left, len));
+                adler->update_u32(wuffs_base__make_slice_u8(bytes, chunk));
+                left -= chunk;
+            }
+            checksumCost.adlerNanosPerByte = static_cast<double>(timer.nsecsElapsed()) / static_cast<double>(inflated);
+        });
+        return checksumCost.crcNanosPerByte * static_cast<double>(len)
+               + checksumCost.adlerNanosPerByte * static_cast<double>(inflated);
+    }
+
+    void log_decode_timing(size_t idx, bool ignoreChecksum, uint64_t elapsedNanos, const uint8_t *ptr, size_t len) {
+        auto debug = qInfo(cat);
+        debug << "Decoded" << idx << "in" << elapsedNanos / 1000000.0 << "ms"
+              << (ignoreChecksum ? "without" : "with") << "checksums";
+        const auto checksums = checksum_nanos(ptr, len);
+        if (!checksums) return;
+        if (ignoreChecksum) {
+            debug << "- skipping them saved about" << *checksums / 1000000.0 << "ms";
+        } else {
+            debug << "- about" << 100.0 * *checksums / static_cast<double>(elapsedNanos) << "% of it verifying them";
+        }
+    }
+
+    // The frame to display. Deep frames are moved into deep and windowed for display.
+    QImage take_frame(wuffs_aux::DecodeImageResult &result, SampleWindow window, DeepFrame &deep) {
+        deep = {};
+        if (!result.pixbuf.pixcfg.is_valid() || !result.pixbuf_mem_owner) return {};
+        if (deep_channels(result.pixbuf.pixcfg.pixel_format())) {
+            deep = std::move(*static_cast<DeepFrame *>(result.pixbuf_mem_owner.get()));
+            return apply_window(deep, window);
+        }
+        return std::move(*static_cast<QImage *>(result.pixbuf_mem_owner.get()));
+    }
+
+    wuffs_aux::DecodeImageResult load_wuffs_image(uint8_t *ptr, size_t len, size_t idx,
+                                                  BufferPool *buffers = nullptr, const DecodeOptions &options = {}) {
+        const auto ignoreChecksum = options.ignoreChecksum;
+        QImageCallbacks callbacks(buffers, options);
+        wuffs_aux::sync_io::MemoryInput input(ptr, len);
+        QElapsedTimer timer;
+        timer.start();
+        wuffs_aux::DecodeImageResult result = wuffs_aux::DecodeImage(callbacks, input);
+        const auto elapsed = static_cast<uint64_t>(timer.nsecsElapsed());
+        if (result.error_message.empty()) log_decode_timing(idx, ignoreChecksum, elapsed, ptr, len);
+        return result;
+    }
+
+    // Halves both dimensions by averaging 2x2 blocks of each 8-bit channel. Odd trailing rows and columns
+    // are dropped.
+    QImage downsample_half(const QImage &src) {
+        const auto bytesPerPixel = src.depth() / 8;
+        auto dst = QImage(std::max(1, src.width() / 2), std::max(1, src.height() / 2), src.format());
+        if (dst.isNull()) return dst;
+
+        const auto rowBytes = static_cast<size_t>(dst.width()) * bytesPerPixel;
+        for (int y = 0; y < dst.height(); ++y) {
+            const auto *row0 = src.constScanLine(std::min(2 * y, src.height() - 1));
+            const auto *row1 = src.constScanLine(std::min(2 * y + 1, src.height() - 1));
+            auto *out = dst.scanLine(y);
+            size_t i = 0;
+#if defined(__SSE2__)
+            if (bytesPerPixel == 4 && src.width() > 1) {
+                const auto zero = _mm_setzero_si128();
+                const auto rounding = _mm_set1_epi16(2);
+                // Four output pixels from eight input pixels of each row
+                for (; i + 16 <= rowBytes; i += 16) {
+                    const auto sumBlock = [&](size_t at) {
+                        const auto top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + at));
+                        const auto bottom = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + at));
+                        const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+                        const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+                        const auto pairLo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                        const auto pairHi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                        return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(pairLo, pairHi), rounding), 2);
+                    };
+                    const auto first = sumBlock(2 * i);
+                    const auto second = sumBlock(2 * i + 16);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(first, second));
+                }
+            }
+            if (bytesPerPixel == 1 && src.width() > 1) {
+                const auto zero = _mm_setzero_si128();
+                const auto ones = _mm_set1_epi16(1);
+                const auto rounding = _mm_set1_epi16(2);
+                // Sixteen output pixels from thirty-two input pixels of each row
+                for (; i + 16 <= rowBytes; i += 16) {
+                    const auto sumBlock = [&](size_t at) {
+                        const auto top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + at));
+                        const auto bottom = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + at));
+                        const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+                        const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+                        // Horizontal neighbours summed into 32-bit lanes, then narrowed back to eight sums
+                        const auto sums = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+                        return _mm_srli_epi16(_mm_add_epi16(sums, rounding), 2);
+                    };
+                    const auto first = sumBlock(2 * i);
+                    const auto second = sumBlock(2 * i + 16);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(first, second));
+                }
+            }
+#endif
+            const auto neighbour = src.width() > 1 ? bytesPerPixel : 0;
+            for (; i < rowBytes; ++i) {
+                const auto at = 2 * (i - i % bytesPerPixel) + i % bytesPerPixel;
+                out[i] = static_cast<uchar>((row0[at] + row0[at + neighbour] + row1[at] + row1[at + neighbour] + 2) / 4);
+            }
+        }
+        return dst;
+    }
+
+    // Successively halved copies of a frame, down to about the size of a thumbnail. Level i is scaled by 2^-(i+1).
+    std::vector<QImage> build_mips(const QImage &image) {
+        static constexpr int smallestLevel = 256;
+        std::vector<QImage> mips;
+        const auto *level = &image;
+        while (std::max(level->width(), level->height()) > smallestLevel) {
+            auto next = downsample_half(*level);
+            if (next.isNull()) break;
+            mips.push_back(std::move(next));
+            level = &mips.back();
+        }
+        return mips;
+    }
+
+    // A frame split into tiles that are read-only views of its rows, so building one copies no pixels. Keeps
+    // every QImage handed to the paint engine within the 32767 px limit of some backends, and lets a paint
+    // touch only the tiles that intersect the exposed area.
+    class TiledImage {
+    public:
+        static constexpr int tileSize = 4096;
+
+        TiledImage() = default;
+
+        explicit TiledImage(QImage image) : m_image{std::move(image)} {
+            const auto bytesPerPixel = m_image.depth() / 8;
+            for (int y = 0; y < m_image.height(); y += tileSize) {
+                for (int x = 0; x < m_image.width(); x += tileSize) {
+                    const auto width = std::min(tileSize, m_image.width() - x);
+                    const auto height = std::min(tileSize, m_image.height() - y);
+                    m_tiles.push_back({QRect(x, y, width, height),
+                                       QImage(m_image.constScanLine(y) + x * bytesPerPixel, width, height,
+                                              m_image.bytesPerLine(), m_image.format())});
+                }
+            }
+        }
+
+        [[nodiscard]] const QImage &image() const {
+            return m_image;
+        }
+
+        // The tiles must not outlive the frame they view
+        QImage release() {
+            m_tiles.clear();
+            return std::move(m_image);
+        }
+
+        // Draws the part of the frame under source, in this frame's pixels, into target
+        void paint(QPainter *painter, const QRectF &target, const QRectF &source) const {
+            const auto scaleX = target.width() / source.width();
+            const auto scaleY = target.height() / source.height();
+            for (const auto &tile: m_tiles) {
+                const auto part = QRectF(tile.rect).intersected(source);
+                if (part.isEmpty()) continue;
+                const auto to = QRectF(target.x() + (part.x() - source.x()) * scaleX,
+                                       target.y() + (part.y() - source.y()) * scaleY,
+                                       part.width() * scaleX,
+                                       part.height() * scaleY);
+                painter->drawImage(to, tile.view, part.translated(-tile.rect.x(), -tile.rect.y()));
+            }
+        }
+
+    private:
+        struct Tile {
+            QRect rect;
+            QImage view;
+        };
+
+        QImage m_image;
+        std::vector<Tile> m_tiles;
+    };
+
+    // Paints the decoded QImage directly instead of keeping a QPixmap copy of it. When zoomed out, paints from
+    // the mip level closest to the view scale so resampling costs screen pixels rather than source pixels.
+    class ImageItem : public QGraphicsItem {
+    public:
+        ImageItem() {
+            setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+        }
+
+        // Returns the previously displayed image. Only the tiles in changed, in image pixels, are repainted;
+        // a null rect means all of them.
+        QImage setImage(QImage image, std::vector<QImage> mips = {}, const QRect &changed = {}) {
+            const auto resized = image.size() != size();
+            if (resized) {
+                prepareGeometryChange();
+                m_size = image.size();
+            }
+
+            std::vector<TiledImage> levels;
+            levels.emplace_back(std::move(image));
+            for (auto &mip: mips) levels.emplace_back(std::move(mip));
+            std::swap(m_levels, levels);
+
+            if (!resized) update(changedRect(changed));
+            return levels.empty() ? QImage() : levels.front().release();
+        }
+
+        [[nodiscard]] QImage image() const {
+            return m_levels.empty() ? QImage() : m_levels.front().image();
+        }
+
+        // Including the mip levels
+        [[nodiscard]] int64_t imageBytes() const {
+            int64_t bytes = 0;
+            for (const auto &level: m_levels) bytes += level.image().sizeInBytes();
+            return bytes;
+        }
+
+        // Drops the pixels but keeps the geometry, so the item still takes up its place while off screen
+        void releaseImage() {
+            if (m_levels.empty()) return;
+            m_levels.clear();
+            update();
+        }
+
+        // A parked item keeps its pixels but is not painted, as it may sit at a stale offset
+        void setParked(bool parked) {
+            if (parked == m_parked) return;
+            m_parked = parked;
+            update();
+        }
+
+        // The size to lay out with until an image arrives
+        void setSize(const QSize &size) {
+            if (size == m_size) return;
+            prepareGeometryChange();
+            m_size = size;
+        }
+
+        // Scene area covered by changed, in image pixels, or the whole item for a null rect
+        [[nodiscard]] QRectF changedRect(const QRect &changed) const {
+            if (changed.isNull()) return boundingRect();
+            return QRectF(changed).translated(m_offset);
+        }
+
+        void setOffset(const QPointF &offset) {
+            if (offset == m_offset) return;
+            prepareGeometryChange();
+            m_offset = offset;
+        }
+
+        void setTransformationMode(Qt::TransformationMode mode) {
+            m_transformationMode = mode;
+            update();
+        }
+
+        [[nodiscard]] QRectF boundingRect() const override {
+            return {m_offset, QSizeF(size())};
+        }
+
+        void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *) override {
+            if (m_parked || m_levels.empty() || m_levels.front().image().isNull()) return;
+
+            painter->setRenderHint(QPainter::SmoothPixmapTransform,
+                                   m_transformationMode == Qt::SmoothTransformation);
+            const auto exposed = option->exposedRect.intersected(boundingRect());
+            const auto source = exposed.translated(-m_offset);
+
+            const auto levelOfDetail = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+            const auto level = levelOfDetail >= 1.0
+                               ? 0
+                               : std::min(static_cast<int>(std::floor(-std::log2(levelOfDetail))),
+                                          static_cast<int>(m_levels.size()) - 1);
+
+            const auto &tiles = m_levels[level];
+            const auto scaleX = static_cast<qreal>(tiles.image().width()) / size().width();
+            const auto scaleY = static_cast<qreal>(tiles.image().height()) / size().height();
+            tiles.paint(painter, exposed, QRectF(source.x() * scaleX, source.y() * scaleY,
+                                                 source.width() * scaleX, source.height() * scaleY));
+        }
+
+    private:
+        [[nodiscard]] QSize size() const {
+            return m_size;
+        }
+
+        std::vector<TiledImage> m_levels;
+        QSize m_size;
+        QPointF m_offset;
+        bool m_parked = false;
+        Qt::TransformationMode m_transformationMode = Qt::FastTransformation;
+    };
+
+    // First byte at which a and b differ, or len
+    size_t first_difference(const uchar *a, const uchar *b, size_t len) {
+        size_t i = 0;
+#if defined(__SSE2__)
+        for (; i + 16 <= len; i += 16) {
+            const auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+            if (_mm_movemask_epi8(equal) != 0xffff) break;
+        }
+#endif
+        while (i < len && a[i] == b[i]) ++i;
+        return i;
+    }
+
+    // One past the last byte at which a and b differ, or 0
+    size_t last_difference(const uchar *a, const uchar *b, size_t len) {
+        size_t i = len;
+#if defined(__SSE2__)
+        for (; i >= 16; i -= 16) {
+            const auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i - 16)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i - 16)));
+            if (_mm_movemask_epi8(equal) != 0xffff) break;
+        }
+#endif
+        while (i > 0 && a[i - 1] == b[i - 1]) --i;
+        return i;
+    }
+
+    // Bounding box of the pixels that differ between two frames, empty when they are identical and nullopt
+    // when they cannot be compared
+    std::optional<QRect> changed_rect(const QImage &before, const QImage &after) {
+        if (before.isNull() || before.size() != after.size() || before.format() != after.format()) {
+            return std::nullopt;
+        }
+
+        const auto bytesPerPixel = static_cast<size_t>(after.depth() / 8);
+        const auto rowBytes = static_cast<size_t>(after.width()) * bytesPerPixel;
+        int top = -1;
+        int bottom = -1;
+        auto left = rowBytes;
+        size_t right = 0;
+        for (int y = 0; y < after.height(); ++y) {
+            const auto *a = before.constScanLine(y);
+            const auto *b = after.constScanLine(y);
+            const auto first = first_difference(a, b, rowBytes);
+            if (first == rowBytes) continue;
+            if (top < 0) top = y;
+            bottom = y;
+            left = std::min(left, first);
+            // Only the part of the row right of what is already known to differ needs a second look
+            right += last_difference(a + right, b + right, rowBytes - right);
+        }
+        if (top < 0) return QRect();
+
+        const auto x0 = static_cast<int>(left / bytesPerPixel);
+        const auto x1 = static_cast<int>((right + bytesPerPixel - 1) / bytesPerPixel);
+        return QRect(x0, top, x1 - x0, bottom - top + 1);
+    }
+
+    struct DecodedFile {
+        QImage image;
+        std::vector<QImage> mips;
+        // Full-depth samples behind image, null unless a 16-bit file was decoded with keepDeepSamples
+        DeepFrame deep;
+        // The window image was mapped through
+        SampleWindow window;
+        // Pixels that differ from the previous frame, null when unknown
+        QRect changed;
+        // Set for a preview of a file that is still being written
+        bool partial = false;
+    };
+
+    bool is_png(const uchar *bytesPtr, size_t size) {
+        return size >= 8 && std::memcmp(bytesPtr, "\x89PNG\r\n\x1A\n", 8) == 0;
+    }
+
+    // The size of a PNG from its header chunks alone. The file is mapped, so only the pages up to the first
+    // IDAT are read. nullopt when the header is missing or broken.
+    std::optional<QSize> probe_png_size(const QString &fileName, BufferPool &buffers) {
+        auto file = QFile(fileName);
+        if (!file.open(QIODevice::OpenModeFlag::ReadOnly)) return std::nullopt;
+        const auto size = static_cast<size_t>(file.size());
+        auto *bytesPtr = size > 8 ? file.map(0, file.size()) : nullptr;
+        if (!bytesPtr) return std::nullopt;
+        const auto unmapFn = Defer{[&] { file.unmap(bytesPtr); }};
+        if (!is_png(bytesPtr, size)) return std::nullopt;
+
+        auto decoder = buffers.acquirePngDecoder();
+        if (!decoder) return std::nullopt;
+        auto src = wuffs_base__ptr_u8__reader(bytesPtr, size, true);
+        auto imageConfig = wuffs_base__null_image_config();
+        const auto status = decoder->decode_image_config(&imageConfig, &src);
+        buffers.releasePngDecoder(std::move(decoder));
+        if (!status.is_ok()) return std::nullopt;
+        return QSize(static_cast<int>(imageConfig.pixcfg.width()), static_cast<int>(imageConfig.pixcfg.height()));
+    }
+
+    // Feeds whatever the file gained since the last call to its streaming decoder and previews the rows so far
+    std::shared_ptr<DecodedFile> decode_growing_file(const uchar *bytesPtr, size_t size, size_t idx,
+                                                      BufferPool *buffers, bool ignoreChecksum,
+                                                      std::unique_ptr<StreamingDecode> &stream) {
+        if (stream && !stream->continues(bytesPtr, size)) {
+            qInfo(cat) << "File" << idx << "was rewritten, restarting its streaming decode";
+            stream.reset();
+        }
+        if (!stream) stream = std::make_unique<StreamingDecode>(*buffers, ignoreChecksum);
+
+        const auto resumedAt = stream->consumed();
+        if (stream->feed(bytesPtr, size) == StreamingDecode::Progress::Failed) {
+            stream.reset();
+            return nullptr;
+        }
+        qInfo(cat) << "Streamed" << idx << "from byte" << resumedAt << "to" << stream->consumed() << "of" << size;
+
+        auto decoded = std::make_shared<DecodedFile>();
+        decoded->image = stream->preview(decoded->changed);
+        decoded->partial = true;
+        return decoded->image.isNull() ? nullptr : decoded;
+    }
+
+    // Cheap evidence that a file was not touched. Rewrites bump ctime even when they restore mtime.
+    struct FileStamp {
+        int64_t size;
+        int64_t mtimeNanos;
+        int64_t ctimeNanos;
+        uint64_t inode;
+
+        bool operator==(const FileStamp &other) const {
+            return size == other.size && mtimeNanos == other.mtimeNanos && ctimeNanos == other.ctimeNanos
+                   && inode == other.inode;
+        }
+    };
+
+    std::optional<FileStamp> stat_path(const char *path) {
+        const auto nanos = [](int64_t sec, int64_t nsec) { return sec * 1000000000 + nsec; };
+#if defined(Q_OS_LINUX) && defined(STATX_BASIC_STATS)
+        // Asks only for the fields compared, which spares network and FUSE filesystems the rest
+        struct statx stx{};
+        if (::statx(AT_FDCWD, path, 0, STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO, &stx) == 0) {
+            return FileStamp{static_cast<int64_t>(stx.stx_size), nanos(stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec),
+                             nanos(stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec), stx.stx_ino};
+        }
+        // Old kernels and some sandboxes lack the syscall
+        if (errno != ENOSYS) return std::nullopt;
+#endif
+        struct stat st{};
+        if (::stat(path, &st) != 0) return std::nullopt;
+        return FileStamp{st.st_size, nanos(st.st_mtim.tv_sec, st.st_mtim.tv_nsec),
+                         nanos(st.st_ctim.tv_sec, st.st_ctim.tv_nsec), st.st_ino};
+    }
+
+    std::optional<FileStamp> stat_file(const QString &fileName) {
+        return stat_path(QFile::encodeName(fileName).constData());
+    }
+
+    std::optional<uint64_t> hash_bytes(const uchar *bytesPtr, size_t size) {
+        const auto hasher = wuffs_xxhash64__hasher::alloc();
+        if (!hasher) return std::nullopt;
+        return hasher->update_u64(wuffs_base__make_slice_u8(const_cast<uchar *>(bytesPtr), size));
+    }
+
+    // Hashes only the chunks that decide the pixels, so a rewrite that just refreshes tEXt or tIME compares
+    // equal. Each chunk's CRC-32 stands in for its data, unless checksums are being ignored and may be stale.
+    // nullopt when the bytes are not a well-formed chunk list.
+    std::optional<uint64_t> hash_png_pixels(const uchar *bytesPtr, size_t size, bool ignoreChecksum) {
+        if (!is_png(bytesPtr, size)) return std::nullopt;
+        const auto hasher = wuffs_xxhash64__hasher::alloc();
+        if (!hasher) return std::nullopt;
+
+        const auto fold = [&](const uchar *ptr, size_t len) {
+            hasher->update(wuffs_base__make_slice_u8(const_cast<uchar *>(ptr), len));
+        };
+        for (size_t at = 8; at + 12 <= size;) {
+            const auto length = size_t{wuffs_base__peek_u32be__no_bounds_check(bytesPtr + at)};
+            if (length > size - at - 12) return std::nullopt;
+            const auto *type = bytesPtr + at + 4;
+            const auto *crc = type + 4 + length;
+            if (std::memcmp(type, "IEND", 4) == 0) return hasher->checksum_u64();
+            if (std::memcmp(type, "IHDR", 4) == 0 || std::memcmp(type, "PLTE", 4) == 0
+                || std::memcmp(type, "tRNS", 4) == 0 || std::memcmp(type, "IDAT", 4) == 0) {
+                // Length and type, then the CRC or the data it covers
+                fold(bytesPtr + at, 8);
+                if (ignoreChecksum) {
+                    fold(type + 4, length);
+                } else {
+                    fold(crc, 4);
+                }
+            }
+            at += 12 + length;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<uint64_t> hash_contents(const uchar *bytesPtr, size_t size, bool ignoreChecksum) {
+        const auto pixels = hash_png_pixels(bytesPtr, size, ignoreChecksum);
+        return pixels ? pixels : hash_bytes(bytesPtr, size);
+    }
+
+    // What a file looked like when it was last read in full. The stamp is checked first and the hash only
+    // when the stamp moved.
+    struct FileFingerprint {
+        std::optional<FileStamp> stamp;
+        std::optional<uint64_t> hash;
+    };
+
+    // Runs on a decode worker. Returns nullptr when the file is unchanged since last or undecodable, and
+    // updates last once the file's current contents have been read in full. The result's image is null when
+    // it would look exactly like previous, the frame currently on screen.
+    // PNGs that are still being written are decoded incrementally through stream.
+    std::shared_ptr<DecodedFile> read_and_decode(const QString &fileName, size_t idx, FileFingerprint &last,
+                                                 QImage previous, BufferPool *buffers, const DecodeOptions &options,
+                                                 std::unique_ptr<StreamingDecode> &stream) {
+        const auto ignoreChecksum = options.ignoreChecksum;
+        // A file read once may never change again, so its work buffer is only kept from the second read on. A
+        // stream still decodes into it.
+        const auto refreshed = last.stamp.has_value();
+        const auto trimWorkbuf = Defer{[&] {
+            if (!refreshed && !stream) buffers->releaseWorkbuf();
+        }};
+        const auto stamp = stat_file(fileName);
+        if (stamp && stamp == last.stamp) {
+            qInfo(cat) << "Skipping image update for" << idx << ": Metadata unchanged";
+            stream.reset();
+            return nullptr;
+        }
+
+        auto file = QFile(fileName);
+        if (!file.open(QIODevice::OpenModeFlag::ReadOnly)) return nullptr;
+
+        const auto size = file.size();
+
+        if (size <= 16) {
+            qInfo(cat) << "Skipping file re-render: Empty file";
+            return nullptr;
+        }
+
+        bool complete;
+        {
+            const auto seekBack = Defer{[&] { file.seek(0); }};
+            file.seek(size - 8);
+            complete = file.read(4) == QByteArrayLiteral("\x49\x45\x4E\x44");
+        }
+
+        const auto bytesPtr = file.map(0, size);
+        if (!bytesPtr) return nullptr;
+        const auto unmapFn = Defer{[&] { file.unmap(bytesPtr); }};
+
+        if (!complete) {
+            if (!is_png(bytesPtr, size)) {
+                qInfo(cat) << "Skipping file re-render: Missing IEND footer";
+                return nullptr;
+            }
+            return decode_growing_file(bytesPtr, size, idx, buffers, ignoreChecksum, stream);
+        }
+
+        const auto hash = hash_contents(bytesPtr, size, ignoreChecksum);
+        if (hash && hash == last.hash) {
+            qInfo(cat) << "Skipping image update for" << idx << ": Pixel data unchanged";
+            last.stamp = stamp;
+            stream.reset();
+            return nullptr;
+        }
+        // A failed decode is not remembered, so the next change event tries again
+        bool failed = false;
+        const auto seen = Defer{[&] {
+            if (!failed) last = {stamp, hash};
+        }};
+
+        auto decoded = std::make_shared<DecodedFile>();
+
+        if (stream && options.keepDeepSamples && stream->hasDeepSource()) {
+            // The stream narrowed its samples for the previews, decode again at full depth
+            stream.reset();
+        }
+        if (stream) {
+            // Finish from where the streaming decode left off instead of inflating the file again
+            const auto finished = stream->continues(bytesPtr, size)
+                                  && stream->feed(bytesPtr, size) == StreamingDecode::Progress::Complete;
+            decoded->image = finished ? stream->takeImage() : QImage();
+            stream.reset();
+            if (!decoded->image.isNull()) qInfo(cat) << "Finished streaming decode of" << idx;
+        }
+
+        if (decoded->image.isNull()) {
+            qInfo(cat) << "Performing image update for" << idx;
+            auto result = load_wuffs_image(bytesPtr, size, idx, buffers, options);
+            decoded->window = options.window;
+            decoded->image = take_frame(result, decoded->window, decoded->deep);
+            // DecodeImage hands back the frame along with the error, e.g. for a checksum mismatch
+            if (!result.error_message.empty() || decoded->image.isNull()) {
+                qWarning(cat) << "Failed to decode" << fileName << result.error_message.c_str();
+                if (!decoded->image.isNull()) buffers->spareFrame = std::move(decoded->image);
+                failed = true;
+                return nullptr;
+            }
+        }
 
-    template<typename Fn>
-    class Defer {
+        if (const auto changed = changed_rect(previous, decoded->image)) {
+            if (changed->isEmpty()) {
+                qInfo(cat) << "Skipping repaint of" << idx << ": Pixels unchanged";
+                buffers->spareFrame = std::move(decoded->image);
+                // A deep frame can differ outside the window, so its samples are still kept
+                return decoded->deep.isNull() ? nullptr : decoded;
+            }
+            qInfo(cat) << "Changed region of" << idx << "is" << *changed << "covering"
+                       << 100.0 * changed->width() * changed->height()
+                          / (static_cast<double>(decoded->image.width()) * decoded->image.height()) << "%";
+            decoded->changed = *changed;
+        }
+        decoded->mips = build_mips(decoded->image);
+        return decoded;
+    }
+
+    // The digits standing in for {n} when name matches pattern, an empty string for a pattern without {n}
+    std::optional<QString> frame_digits(const QString &pattern, const QString &name) {
+        const auto at = pattern.indexOf(QStringLiteral("{n}"));
+        if (at < 0) return name == pattern ? std::optional<QString>(QString()) : std::nullopt;
+        const auto suffix = pattern.mid(at + 3);
+        if (name.size() <= pattern.size() - 3 || !name.startsWith(pattern.left(at)) || !name.endsWith(suffix)) {
+            return std::nullopt;
+        }
+        auto digits = name.mid(at, name.size() - at - suffix.size());
+        if (!std::all_of(digits.begin(), digits.end(), [](QChar c) { return c.isDigit(); })) return std::nullopt;
+        return digits;
+    }
+
+    // Modification times of the directory entries matching a file pattern, sorted by frame number. Kept
+    // current from watcher events, so a change costs a stat of the entries it names rather than of every
+    // candidate file name.
+    class FrameIndex {
     public:
-        explicit Defer(Fn fn) : m_fn(std::move(fn)) {}
+        // A file of the sequence. The digits keep its zero padding.
+        struct Frame {
+            uint64_t number;
+            QString digits;
 
-        Defer(const Defer &) = delete;
+            bool operator<(const Frame &other) const {
+                return number != other.number ? number < other.number : digits < other.digits;
+            }
 
-        Defer(Defer &&) = delete;
+            // Whether the digits are number zero-padded to width, which never truncates
+            [[nodiscard]] bool hasWidth(qsizetype width) const {
+                return digits.size() == width || (digits.size() > width && !digits.startsWith(QStringLiteral("0")));
+            }
+        };
 
-        Defer &operator=(const Defer &) = delete;
+        // One listing of dir, stat'ing only the entries that match pattern
+        void rebuild(const QDir &dir, const QString &pattern) {
+            m_modified.clear();
+            for (const auto &name: dir.entryList(QDir::Files)) update(dir, pattern, name);
+        }
 
-        Defer &operator=(Defer &&) = delete;
+        // Picks up an entry that was added, rewritten or removed. The frame it names, if any, and whether the
+        // file is there.
+        std::optional<std::pair<Frame, bool>> update(const QDir &dir, const QString &pattern, const QString &name) {
+            const auto digits = frame_digits(pattern, name);
+            if (!digits) return std::nullopt;
+            // A pattern without {n} names a single file, frame 0
+            bool ok = digits->isEmpty();
+            auto frame = Frame{ok ? 0 : digits->toULongLong(&ok), *digits};
+            if (!ok) return std::nullopt;
+            const auto stamp = stat_file(dir.filePath(name));
+            if (stamp) {
+                m_modified[frame] = stamp->mtimeNanos;
+            } else {
+                m_modified.erase(frame);
+            }
+            return std::pair<Frame, bool>(std::move(frame), stamp.has_value());
+        }
 
-        ~Defer() noexcept(false) { m_fn(); }
+        // The frames padded like the most recently modified one, in order. An unpadded newest file fits
+        // several widths, the one that takes in the most frames wins.
+        [[nodiscard]] std::vector<Frame> sequence(qsizetype &width) const {
+            width = 1;
+            if (m_modified.empty()) return {};
+
+            const auto byModified = [](const auto &a, const auto &b) { return a.second < b.second; };
+            const auto &newest = std::max_element(m_modified.begin(), m_modified.end(), byModified)->first;
+            const auto countWidth = [&](qsizetype candidate) {
+                return std::count_if(m_modified.begin(), m_modified.end(), [&](const auto &entry) {
+                    return entry.first.hasWidth(candidate);
+                });
+            };
+            width = newest.digits.size();
+            if (!newest.digits.startsWith(QStringLiteral("0"))) {
+                auto best = countWidth(width);
+                for (qsizetype candidate = width - 1; candidate >= 1; --candidate) {
+                    if (const auto count = countWidth(candidate); count >= best) {
+                        best = count;
+                        width = candidate;
+                    }
+                }
+            }
+
+            std::vector<Frame> frames;
+            for (const auto &[frame, modified]: m_modified) {
+                if (frame.hasWidth(width)) frames.push_back(frame);
+            }
+            return frames;
+        }
 
     private:
-        Fn m_fn;
+        std::map<Frame, int64_t> m_modified;
     };
 
-    wuffs_aux::DecodeImageResult load_wuffs_image(uint8_t *ptr, size_t len) {
-        wuffs_aux::DecodeImageCallbacks callbacks;
-        wuffs_aux::sync_io::MemoryInput input(ptr, len);
-        wuffs_aux::DecodeImageResult result = wuffs_aux::DecodeImage(callbacks, input);
-        return result;
-    }
+    // Vertical offsets of a column of items with spacing above each. The extents live in a Fenwick tree, so a
+    // resize, removal or append moves every later offset in O(log n) and the item at a given height is found in
+    // O(log n). A removed item keeps its index with no extent.
+    class ColumnLayout {
+    public:
+        explicit ColumnLayout(int64_t spacing) : m_spacing{spacing} {}
+
+        void assign(const std::vector<int64_t> &heights) {
+            m_extents.clear();
+            m_extents.reserve(heights.size());
+            for (const auto height: heights) m_extents.push_back(height + m_spacing);
+            m_tree.assign(m_extents.size() + 1, 0);
+            for (size_t i = 1; i < m_tree.size(); ++i) {
+                m_tree[i] += m_extents[i - 1];
+                if (const auto parent = i + (i & -i); parent < m_tree.size()) m_tree[parent] += m_tree[i];
+            }
+        }
+
+        void setHeight(size_t index, int64_t height) {
+            setExtent(index, height + m_spacing);
+        }
+
+        void remove(size_t index) {
+            setExtent(index, 0);
+        }
+
+        void append(int64_t height) {
+            m_extents.push_back(height + m_spacing);
+            const auto i = m_extents.size();
+            // Covers the items from i - (i & -i) to i - 1
+            m_tree.push_back(m_extents.back() + prefix(i - 1) - prefix(i - (i & -i)));
+        }
+
+        [[nodiscard]] size_t size() const {
+            return m_extents.size();
+        }
+
+        [[nodiscard]] int64_t offset(size_t index) const {
+            return m_spacing + prefix(index);
+        }
+
+        // Down to the spacing below the last item
+        [[nodiscard]] int64_t extent() const {
+            return offset(size());
+        }
+
+        // The item at y, counting the spacing below an item as its own, clamped to the first and last. Removed
+        // items are skipped, except at the very end.
+        [[nodiscard]] size_t indexAt(qreal y) const {
+            if (m_extents.empty()) return 0;
+            size_t at = 0;
+            auto remaining = y - static_cast<qreal>(m_spacing);
+            auto step = size_t{1};
+            while (step * 2 < m_tree.size()) step *= 2;
+            for (; step > 0; step /= 2) {
+                if (at + step < m_tree.size() && static_cast<qreal>(m_tree[at + step]) <= remaining) {
+                    at += step;
+                    remaining -= static_cast<qreal>(m_tree[at]);
+                }
+            }
+            return std::min(at, size() - 1);
+        }
+
+    private:
+        void setExtent(size_t index, int64_t extent) {
+            const auto delta = extent - std::exchange(m_extents[index], extent);
+            for (auto i = index + 1; i < m_tree.size(); i += i & -i) m_tree[i] += delta;
+        }
+
+        // Extents of the first count items
+        [[nodiscard]] int64_t prefix(size_t count) const {
+            int64_t sum = 0;
+            for (auto i = count; i > 0; i -= i & -i) sum += m_tree[i];
+            return sum;
+        }
+
+        int64_t m_spacing;
+        // Height plus spacing, or nothing for a removed item
+        std::vector<int64_t> m_extents;
+        // 1-based, m_tree[i] sums the extents of the i & -i items up to item i - 1
+        std::vector<int64_t> m_tree;
+    };
+
+    // Watches the files of one directory. On Linux this is a single inotify watch, which also tells when a writer
+    // is done with a file. Elsewhere it falls back to QFileSystemWatcher, which watches each file passed to
+    // setFiles. Either way a file replaced by rename() keeps being reported under its path.
+    class DirectoryWatcher : public QObject {
+    public:
+        // Whether a file name that is not being watched yet could be worth a rescan when it appears
+        std::function<bool(const QString &)> isCandidate;
+        // A file is being written to
+        std::function<void(const QString &)> fileChanged;
+        // A writer closed a file or renamed one into place
+        std::function<void(const QString &)> fileWritten;
+        // Entries with these names may have been added, removed or rewritten
+        std::function<void(const QStringList &)> entriesChanged;
+        // Something in the directory changed, without saying what
+        std::function<void()> directoryChanged;
+        // Events were dropped, so any file may have changed
+        std::function<void()> eventsLost;
+
+        DirectoryWatcher(const QString &dir, bool poll, QObject *parent) : QObject{parent}, m_dir{dir} {
+            if (poll) {
+                startPolling();
+                return;
+            }
+#if defined(Q_OS_LINUX)
+            static constexpr uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                                             | IN_MOVED_TO;
+            m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (m_fd >= 0 && inotify_add_watch(m_fd, QFile::encodeName(dir).constData(), mask) >= 0) {
+                auto *notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+                QObject::connect(notifier, &QSocketNotifier::activated, [this] { readEvents(); });
+                qInfo(cat) << "Watching" << dir << "with inotify";
+                return;
+            }
+            qWarning(cat) << "Cannot watch" << dir << "with inotify:" << std::strerror(errno);
+            if (m_fd >= 0) ::close(std::exchange(m_fd, -1));
+#endif
+            m_fallback = new QFileSystemWatcher(this);
+            m_fallback->addPath(dir);
+            QObject::connect(m_fallback, &QFileSystemWatcher::fileChanged, [this](const QString &path) {
+                // QFileSystemWatcher drops the watch when a rename replaces the file
+                if (!m_fallback->files().contains(path) && QFileInfo::exists(path)) m_fallback->addPath(path);
+                if (fileChanged) fileChanged(path);
+            });
+            QObject::connect(m_fallback, &QFileSystemWatcher::directoryChanged, [this](const QString &) {
+                if (directoryChanged) directoryChanged();
+            });
+        }
+
+        ~DirectoryWatcher() override {
+#if defined(Q_OS_LINUX)
+            if (m_fd >= 0) ::close(m_fd);
+#endif
+        }
+
+        // The files to report on. Only the difference to the previous set is applied.
+        void setFiles(const QStringList &files) {
+            QSet<QString> tracked;
+            QStringList added;
+            for (const auto &file: files) {
+                const auto name = QFileInfo(file).fileName();
+                tracked.insert(name);
+                if (!m_tracked.remove(name)) added << file;
+            }
+            QStringList removed;
+            for (const auto &name: m_tracked) removed << m_dir.filePath(name);
+            m_tracked = std::move(tracked);
+            if (!added.isEmpty() || !removed.isEmpty()) {
+                qInfo(cat) << "Watching" << added.size() << "more and" << removed.size() << "fewer files";
+            }
+
+            if (m_poll) {
+                QHash<QString, PolledFile> previous;
+                for (auto &file: m_polled) previous.insert(file.name, std::move(file));
+                m_polled.clear();
+                m_polled.reserve(files.size());
+                for (const auto &file: files) {
+                    const auto name = QFileInfo(file).fileName();
+                    auto it = previous.find(name);
+                    if (it != previous.end()) {
+                        m_polled.push_back(std::move(*it));
+                        continue;
+                    }
+                    m_polled.push_back(polledFile(name));
+                }
+                m_polledAt.clear();
+                m_polledAt.reserve(static_cast<qsizetype>(m_polled.size()));
+                for (size_t i = 0; i < m_polled.size(); ++i) m_polledAt.insert(m_polled[i].name, i);
+                m_pollCursor = std::min(m_pollCursor, m_polled.size());
+                return;
+            }
+            if (!m_fallback) return;
+            if (!removed.isEmpty()) m_fallback->removePaths(removed);
+            if (!added.isEmpty()) m_fallback->addPaths(added);
+        }
+
+        // Adds one file to the set, without going over the others like setFiles
+        void watchFile(const QString &file) {
+            const auto name = QFileInfo(file).fileName();
+            if (m_tracked.contains(name)) return;
+            m_tracked.insert(name);
+            if (m_poll) {
+                m_polledAt.insert(name, m_polled.size());
+                m_polled.push_back(polledFile(name));
+            } else if (m_fallback) {
+                m_fallback->addPath(file);
+            }
+        }
+
+        void unwatchFile(const QString &file) {
+            const auto name = QFileInfo(file).fileName();
+            if (!m_tracked.remove(name)) return;
+            if (m_poll) {
+                // The last file takes its place, so it may be skipped for the rest of this pass
+                const auto at = m_polledAt.take(name);
+                if (at + 1 < m_polled.size()) {
+                    std::swap(m_polled[at], m_polled.back());
+                    m_polledAt.insert(m_polled[at].name, at);
+                }
+                m_polled.pop_back();
+                m_pollCursor = std::min(m_pollCursor, m_polled.size());
+            } else if (m_fallback) {
+                m_fallback->removePath(file);
+            }
+        }
+
+    private:
+        // Polls are spaced out to keep the time spent stat'ing under 1/kPollDutyCycle of one core
+        static constexpr int kMinPollMillis = 20;
+        static constexpr int kMaxPollMillis = 1000;
+        static constexpr size_t kPollBatch = 256;
+        static constexpr int64_t kPollDutyCycle = 20;
+        static constexpr int64_t kPollReportMillis = 10000;
+
+        struct PolledFile {
+            QString name;
+            QByteArray path;
+            std::optional<FileStamp> stamp;
+            // Changed during the previous pass and may still be being written
+            bool settling = false;
+        };
+
+        // A batch of stats taken on m_statPool, in the order of names
+        struct PollBatch {
+            std::vector<QString> names;
+            std::vector<QByteArray> paths;
+            std::vector<std::optional<FileStamp>> stamps;
+            // The first batch of a pass also checks the directory
+            bool statDirectory = false;
+            std::optional<FileStamp> dirStamp;
+            // Only when the directory stamp moved
+            std::optional<QStringList> listing;
+            int64_t nanos = 0;
+        };
+
+        [[nodiscard]] PolledFile polledFile(const QString &name) const {
+            auto path = QFile::encodeName(m_dir.filePath(name));
+            const auto stamp = stat_path(path.constData());
+            return {name, std::move(path), stamp};
+        }
+
+        void startPolling() {
+            m_dirPath = QFile::encodeName(m_dir.absolutePath());
+            // One batch at a time, each started by the timer once the previous one is reported
+            m_statPool.setMaxThreadCount(1);
+            m_poll = new QTimer(this);
+            m_poll->setSingleShot(true);
+            QObject::connect(m_poll, &QTimer::timeout, [this] { poll(); });
+            m_poll->start(m_pollMillis);
+            m_pollReport.start();
+            qInfo(cat) << "Polling" << m_dir.path() << "every" << kMinPollMillis << "to" << kMaxPollMillis << "ms";
+        }
+
+        // Hands the next batch of watched files to m_statPool, so a slow mount stalls a worker rather than the
+        // GUI. A pass starts with the directory, which is listed again whenever its stamp moved.
+        void poll() {
+            auto batch = std::make_shared<PollBatch>();
+            batch->statDirectory = m_pollCursor == 0;
+            const auto end = std::min(m_pollCursor + kPollBatch, m_polled.size());
+            for (; m_pollCursor < end; ++m_pollCursor) {
+                batch->names.push_back(m_polled[m_pollCursor].name);
+                batch->paths.push_back(m_polled[m_pollCursor].path);
+            }
+            m_statPool.start([this, batch, dir = m_dir, dirPath = m_dirPath, dirStamp = m_dirStamp] {
+                QElapsedTimer busy;
+                busy.start();
+                batch->stamps.reserve(batch->paths.size());
+                for (const auto &path: batch->paths) batch->stamps.push_back(stat_path(path.constData()));
+                if (batch->statDirectory) {
+                    batch->dirStamp = stat_path(dirPath.constData());
+                    if (!(batch->dirStamp == dirStamp)) batch->listing = dir.entryList(QDir::Files);
+                }
+                batch->nanos = busy.nsecsElapsed();
+                QMetaObject::invokeMethod(this, [this, batch] { pollFinished(*batch); }, Qt::QueuedConnection);
+            });
+        }
+
+        // Reports what a batch found. Growth shows up as fileChanged, and a file that then holds still for a
+        // pass or gets renamed over as fileWritten, the nearest to inotify's close-write. Entries that came or
+        // went show up as entriesChanged, like inotify's create and delete events.
+        void pollFinished(const PollBatch &batch) {
+            QElapsedTimer busy;
+            busy.start();
+
+            QStringList changing;
+            QStringList written;
+            QStringList entries;
+            m_pollStats += static_cast<int64_t>(batch.paths.size()) + (batch.statDirectory ? 1 : 0);
+            if (batch.statDirectory && !(batch.dirStamp == m_dirStamp)) {
+                m_dirStamp = batch.dirStamp;
+                m_pollActive = true;
+                if (batch.listing) entries = diffListing(*batch.listing);
+            }
+            for (size_t i = 0; i < batch.names.size(); ++i) {
+                // Unwatched while the batch was out
+                const auto at = m_polledAt.find(batch.names[i]);
+                if (at == m_polledAt.end()) continue;
+                auto &file = m_polled[*at];
+                const auto &stamp = batch.stamps[i];
+                if (stamp == file.stamp) {
+                    if (std::exchange(file.settling, false)) written << m_dir.filePath(file.name);
+                    continue;
+                }
+                m_pollActive = true;
+                if (!stamp || !file.stamp) {
+                    entries << file.name;
+                } else if (stamp->inode != file.stamp->inode) {
+                    written << m_dir.filePath(file.name);
+                    file.settling = false;
+                } else {
+                    changing << m_dir.filePath(file.name);
+                    file.settling = true;
+                }
+                file.stamp = stamp;
+            }
+
+            // Before the interval is picked, so the work they cause counts against the duty cycle. They may
+            // also change the polled files.
+            for (const auto &path: changing) {
+                if (fileChanged) fileChanged(path);
+            }
+            for (const auto &path: written) {
+                if (fileWritten) fileWritten(path);
+            }
+            entries.removeDuplicates();
+            if (!entries.isEmpty() && entriesChanged) entriesChanged(entries);
+
+            // Back off while nothing happens, come straight back once something does
+            auto waitMillis = int64_t{0};
+            if (m_pollCursor >= m_polled.size()) {
+                m_pollCursor = 0;
+                m_pollMillis = m_pollActive ? kMinPollMillis : std::min(m_pollMillis * 2, kMaxPollMillis);
+                m_pollActive = false;
+                waitMillis = m_pollMillis;
+            }
+            const auto busyNanos = batch.nanos + busy.nsecsElapsed();
+            m_pollBusyNanos += busyNanos;
+            waitMillis = std::max<int64_t>(waitMillis, busyNanos * (kPollDutyCycle - 1) / 1000000);
+            m_poll->start(static_cast<int>(std::min<int64_t>(waitMillis, kMaxPollMillis * kPollDutyCycle)));
+
+            if (m_pollReport.elapsed() >= kPollReportMillis) {
+                qInfo(cat) << "Polling made" << m_pollStats << "stats in" << m_pollBusyNanos / 1000000 << "ms over"
+                           << m_pollReport.elapsed() << "ms," << 100.0 * m_pollBusyNanos / m_pollReport.nsecsElapsed()
+                           << "% of a core, interval" << m_pollMillis << "ms";
+                m_pollStats = 0;
+                m_pollBusyNanos = 0;
+                m_pollReport.restart();
+            }
+        }
+
+        // The names that came or went since the previous listing, leaving out those not worth a look. The first
+        // listing only sets the baseline.
+        QStringList diffListing(const QStringList &listing) {
+            auto names = QSet<QString>(listing.begin(), listing.end());
+            QStringList changed;
+            if (m_listing) {
+                for (const auto &name: names) {
+                    if (!m_listing->contains(name)) changed << name;
+                }
+                for (const auto &name: *m_listing) {
+                    if (!names.contains(name)) changed << name;
+                }
+            }
+            m_listing = std::move(names);
+            QStringList relevant;
+            for (const auto &name: changed) {
+                if (m_tracked.contains(name) || !isCandidate || isCandidate(name)) relevant << name;
+            }
+            return relevant;
+        }
+
+#if defined(Q_OS_LINUX)
+        void readEvents() {
+            alignas(inotify_event) char buffer[64 * 1024];
+            QStringList changed;
+            bool lost = false;
+            for (;;) {
+                const auto len = ::read(m_fd, buffer, sizeof buffer);
+                // EAGAIN once the queue is drained
+                if (len <= 0) break;
+                for (ssize_t at = 0; at < len;) {
+                    const auto *event = reinterpret_cast<const inotify_event *>(buffer + at);
+                    at += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                    lost |= (event->mask & IN_Q_OVERFLOW) != 0;
+                    if (event->len == 0) continue;
+
+                    const auto name = QFile::decodeName(event->name);
+                    if (!m_tracked.contains(name)) {
+                        // Temporary files written next to a frame and renamed over it never get here
+                        if ((event->mask & ~IN_MODIFY) && (!isCandidate || isCandidate(name))) changed << name;
+                        continue;
+                    }
+
+                    // A rename over a watched file arrives as IN_MOVED_TO on its name and needs no rescan
+                    const auto path = m_dir.filePath(name);
+                    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) changed << name;
+                    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                        if (fileWritten) fileWritten(path);
+                    } else if (event->mask & IN_MODIFY) {
+                        if (fileChanged) fileChanged(path);
+                    }
+                }
+            }
+            changed.removeDuplicates();
+            if (!changed.isEmpty() && entriesChanged) entriesChanged(changed);
+            if (lost) {
+                qWarning(cat) << "inotify queue overflowed for" << m_dir.path();
+                if (eventsLost) eventsLost();
+            }
+        }
+
+        int m_fd = -1;
+#endif
+        QDir m_dir;
+        QSet<QString> m_tracked;
+        QFileSystemWatcher *m_fallback = nullptr;
+
+        QTimer *m_poll = nullptr;
+        QByteArray m_dirPath;
+        std::optional<FileStamp> m_dirStamp;
+        std::optional<QSet<QString>> m_listing;
+        std::vector<PolledFile> m_polled;
+        QHash<QString, size_t> m_polledAt;
+        size_t m_pollCursor = 0;
+        int m_pollMillis = kMinPollMillis;
+        bool m_pollActive = false;
+        QElapsedTimer m_pollReport;
+        int64_t m_pollStats = 0;
+        int64_t m_pollBusyNanos = 0;
+        // Last, so it is drained before the rest goes away
+        QThreadPool m_statPool;
+    };
 }
 
 int main(int argc, char *argv[]) {
@@ -53,208 +1814,826 @@ int main(int argc, char *argv[]) {
     auto *view = new QGraphicsView(scene, window);
     view->setDragMode(QGraphicsView::DragMode::ScrollHandDrag);
 
-    const auto pattern = QFileInfo(QCoreApplication::arguments().at(1));
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("A fast okular-like UI for real-time updates to PNG"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("pattern"),
+                                 QStringLiteral("Image path with {n} in place of the frame number"));
+    const auto trustOption = QCommandLineOption(QStringLiteral("trust"),
+                                                QStringLiteral("Skip zlib and CRC checksum verification for "
+                                                               "images under <dir>. Can be repeated."),
+                                                QStringLiteral("dir"));
+    parser.addOption(trustOption);
+    const auto deepOption = QCommandLineOption(QStringLiteral("keep-16bit"),
+                                               QStringLiteral("Keep 16-bit images at full depth and map them to "
+                                                              "the display through an adjustable window."));
+    parser.addOption(deepOption);
+    const auto quietOption = QCommandLineOption(QStringLiteral("quiet-ms"),
+                                                QStringLiteral("Wait until a file has had no change events for <ms> "
+                                                               "before refreshing it. Defaults to 25."),
+                                                QStringLiteral("ms"), QStringLiteral("25"));
+    parser.addOption(quietOption);
+    const auto latencyOption = QCommandLineOption(QStringLiteral("max-latency-ms"),
+                                                  QStringLiteral("Refresh a file at most <ms> after the first change "
+                                                                 "event of a burst. Defaults to 200."),
+                                                  QStringLiteral("ms"), QStringLiteral("200"));
+    parser.addOption(latencyOption);
+    const auto pollOption = QCommandLineOption(QStringLiteral("poll"),
+                                               QStringLiteral("Poll the watched files instead of waiting for change "
+                                                              "notifications, which FUSE and some container volumes "
+                                                              "never deliver."));
+    parser.addOption(pollOption);
+    const auto budgetOption = QCommandLineOption(QStringLiteral("memory-budget"),
+                                                 QStringLiteral("Keep decoded frames that scrolled out of view while "
+                                                                "all decoded frames take up less than <size>, in MiB "
+                                                                "or as a percentage of physical memory. Defaults to "
+                                                                "25%."),
+                                                 QStringLiteral("size"), QStringLiteral("25%"));
+    parser.addOption(budgetOption);
+    parser.process(app);
+    if (parser.positionalArguments().isEmpty()) parser.showHelp(1);
+
+    const auto pattern = QFileInfo(parser.positionalArguments().at(0));
 
     static auto root = pattern.dir();
     static auto filePattern = pattern.fileName();
-    static size_t fileCount = 0;
-    static size_t width = 1;
-
-    static const auto makeFilename = [](size_t idx) {
-        return root.filePath(QString(filePattern)
-                                     .replace(QStringLiteral("{n}"),
-                                              QStringLiteral("%1").arg(idx,
-                                                                       width,
-                                                                       10,
-                                                                       QChar('0'))));
+    static bool ignoreChecksum = [&] {
+        const auto canonical = [](const QString &path) {
+            const auto info = QFileInfo(path);
+            return info.canonicalFilePath().isEmpty() ? info.absoluteFilePath() : info.canonicalFilePath();
+        };
+        const auto rootPath = canonical(root.absolutePath());
+        const auto trusted = parser.values(trustOption);
+        return std::any_of(trusted.begin(), trusted.end(), [&](const QString &dir) {
+            const auto trustedPath = canonical(dir);
+            return rootPath == trustedPath || rootPath.startsWith(trustedPath + QStringLiteral("/"));
+        });
+    }();
+    qInfo(cat) << "Checksum verification" << (ignoreChecksum ? "disabled" : "enabled") << "for" << root.path();
+    static const bool keepDeepSamples = parser.isSet(deepOption);
+    static SampleWindow sampleWindow;
+    static const auto decodeOptions = [] {
+        return DecodeOptions{ignoreChecksum, keepDeepSamples, sampleWindow};
     };
 
+    // Change events for a file are coalesced into one refresh per burst
+    static const int quietMillis = std::max(0, parser.value(quietOption).toInt());
+    static const int maxLatencyMillis = std::max(quietMillis, parser.value(latencyOption).toInt());
+    qInfo(cat) << "Coalescing change events for" << quietMillis << "ms, up to" << maxLatencyMillis << "ms";
+
+    // Beyond this many bytes of decoded pixels, frames out of view are evicted least recently viewed first
+    static const int64_t memoryBudget = [&] {
+        const auto value = parser.value(budgetOption);
+        bool ok = false;
+        if (value.endsWith(QStringLiteral("%"))) {
+            const auto percent = value.chopped(1).toDouble(&ok);
+            const auto pages = ::sysconf(_SC_PHYS_PAGES);
+            const auto pageSize = ::sysconf(_SC_PAGE_SIZE);
+            if (ok && percent >= 0 && pages > 0 && pageSize > 0) {
+                return static_cast<int64_t>(static_cast<double>(pages) * static_cast<double>(pageSize) * percent / 100);
+            }
+        } else if (const auto mebibytes = value.toLongLong(&ok); ok && mebibytes >= 0) {
+            return int64_t{mebibytes} << 20;
+        }
+        qWarning(cat) << "Cannot use" << value << "as a memory budget, keeping 1024 MiB";
+        return int64_t{1024} << 20;
+    }();
+    qInfo(cat) << "Keeping up to" << (memoryBudget >> 20) << "MiB of decoded frames";
+
+    static auto *decodePool = new QThreadPool(window);
+    decodePool->setMaxThreadCount(QThread::idealThreadCount());
+    qInfo(cat) << "Decoding on" << decodePool->maxThreadCount() << "threads";
+    // Queued decodes start highest first
+    enum class DecodePriority { OffScreen, Prefetch, Visible };
+    // Running average, for how far ahead of a scroll to prefetch
+    static double decodeMillis = 50;
+    // The slot of a frame that is not on display
+    static constexpr size_t noSlot = SIZE_MAX;
+
     struct ImgState {
     public:
-        explicit ImgState(size_t idx, QGraphicsPixmapItem *item)
-                : m_idx{idx}, m_pixMap{item}, m_store("Empty") {
-            qInfo(cat) << "Adding file " << idx << " with offset " << item->boundingRect().bottomLeft();
-        }
-
-        QPixmap mapPixels() {
-            const auto pixfmt = [&] {
-                switch (m_store.pixbuf.pixel_format().repr) {
-                    case WUFFS_BASE__PIXEL_FORMAT__BGRA_PREMUL: return QImage::Format_ARGB32_Premultiplied;
-                    default: {
-                        qFatal(cat) << "Unknown pixfmt" << std::hex << m_store.pixbuf.pixel_format().repr;
-                        throw std::runtime_error{"unknown pixfmt"};
-                    }
-                }
-            }();
-            auto plane = m_store.pixbuf.plane(0);
-            return QPixmap::fromImage(QImage(plane.ptr,
-                                             static_cast<int>(plane.width) / 4,
-                                             static_cast<int>(plane.height),
-                                             pixfmt));
+        // The item changed size, so the frames below it need to move
+        std::function<void(ImgState &)> geometryChanged;
+
+        ImgState(size_t idx, QString fileName, ImageItem *item)
+                : m_idx{idx}, m_fileName{std::move(fileName)}, m_item{item} {
+            qInfo(cat) << "Adding file" << idx << m_fileName;
+            m_quietTimer.setSingleShot(true);
+            QWidget::connect(&m_quietTimer, &QTimer::timeout, [this] {
+                qInfo(cat) << "Coalesced" << m_coalesced << "change events for" << m_idx << "over"
+                           << m_burst.elapsed() << "ms";
+                m_burst.invalidate();
+                refresh(m_burstView);
+            });
+        }
+
+        // The writer is done with the file, so there is nothing left to wait for
+        void refreshNow(QGraphicsView *view) {
+            if (m_burst.isValid()) {
+                qInfo(cat) << "Coalesced" << m_coalesced << "change events for" << m_idx << "before the write finished";
+            }
+            m_quietTimer.stop();
+            m_burst.invalidate();
+            refresh(view);
+        }
+
+        // Refreshes once the file has gone quiet, or once the burst has lasted maxLatencyMillis, so a writer
+        // issuing many write() calls costs one refresh that sees its final state
+        void scheduleRefresh(QGraphicsView *view) {
+            if (!m_burst.isValid()) {
+                m_burst.start();
+                m_coalesced = 0;
+            }
+            m_burstView = view;
+            ++m_coalesced;
+            const auto remaining = std::max<qint64>(0, maxLatencyMillis - m_burst.elapsed());
+            m_quietTimer.start(static_cast<int>(std::min<qint64>(quietMillis, remaining)));
         }
 
         void setVisible(bool visible) {
-            m_pixMap->setPixmap(visible ? mapPixels() : QPixmap());
+            m_item->setVisible(visible);
         }
 
-        void fetch(uchar *bytesPtr, size_t size) {
-            qInfo(cat) << "Performing image update for" << m_idx;
-            m_store = load_wuffs_image(bytesPtr, size);
-            m_pixMap->setPixmap(mapPixels());
-            qInfo(cat) << "Loaded image";
+        [[nodiscard]] bool isVisible() const {
+            return m_item->isVisible();
         }
 
-        void fetch() {
-            auto file = QFile(fileName());
-            file.open(QIODeviceBase::OpenModeFlag::ReadOnly);
-            auto bytesPtr = file.map(0, file.size());
-            const auto unmapFn = Defer{[&] { file.unmap(bytesPtr); }};
-            fetch(bytesPtr, file.size());
+        void setOffset(const QPointF &offset) {
+            m_item->setOffset(offset);
         }
 
-        void refresh(QGraphicsView *view) {
-            qInfo(cat) << "Refreshing" << m_idx;
+        void setSize(const QSize &size) {
+            m_item->setSize(size);
+        }
+
+        // Position among the frames on display. A frame deleted since the last full pass keeps the null slot it
+        // left, any other hidden frame has noSlot.
+        [[nodiscard]] size_t slot() const {
+            return m_slot;
+        }
+
+        void setSlot(size_t slot) {
+            m_slot = slot;
+        }
+
+        // Decodes the frame again once it comes into view. Its fingerprint and stream describe pixels that are
+        // gone, so the decode starts from scratch.
+        void load(QGraphicsView *view) {
+            if (m_resident) {
+                // Cached pixels are still good unless the file changed meanwhile. updateResidency has moved the
+                // item back into place.
+                m_parked = false;
+                m_item->setParked(false);
+                // The window moved while it was cached
+                if (m_window != sampleWindow) applyWindow(view);
+                if (std::exchange(m_stale, false)) refresh(view);
+                return;
+            }
+            m_resident = true;
+            m_reload = true;
+            refresh(view);
+        }
+
+        // Keeps the pixels of a frame that went out of view but lets go of its decode buffers. Changes to the
+        // file wait until it is back in view.
+        void park() {
+            if (!m_resident || std::exchange(m_parked, true)) return;
+            m_item->setParked(true);
+            if (!m_decoding) freeBuffers();
+        }
+
+        // Drops the pixels of a frame that went out of view, keeping its geometry
+        void release() {
+            if (!m_resident) return;
+            m_resident = false;
+            m_parked = false;
+            m_item->setParked(false);
+            m_stale = false;
+            m_item->releaseImage();
+            m_deep = {};
+            // An in-flight decode still owns the buffers, finishRefresh frees them once it lands
+            if (!m_decoding) freeBuffers();
+        }
+
+        [[nodiscard]] int64_t pixelBytes() const {
+            // The worker owns the buffers while decoding, so that counts what it was handed
+            return m_item->imageBytes() + m_deep.sizeInBytes() + (m_decoding ? m_bufferBytes : bufferBytes());
+        }
 
-            auto file = QFile(fileName());
-            if (!file.open(QIODevice::OpenModeFlag::ReadOnly)) return;
+        // When the frame was last near the viewport, in updates of the viewport
+        [[nodiscard]] uint64_t lastViewed() const {
+            return m_lastViewed;
+        }
+
+        void touch(uint64_t tick) {
+            m_lastViewed = tick;
+        }
+
+        [[nodiscard]] bool isResident() const {
+            return m_resident;
+        }
+
+        // Takes back a load that has not started decoding, so a frame scrolled past costs nothing
+        bool cancelLoad() {
+            if (!m_decoding || !m_pendingLoad || m_pendingLoad->exchange(true)) return false;
+            release();
+            // Winning the claim means the task has not run yet, so it is still alive. It is most likely still
+            // queued at its old priority, where it would hold up a reload of this frame until it drained. A
+            // worker that just dequeued it finds the claim taken and reports back without decoding.
+            if (decodePool->tryTake(m_pendingTask)) {
+                delete m_pendingTask;
+                m_decoding = false;
+                m_refreshPending = false;
+                m_pendingLoad.reset();
+                freeBuffers();
+            }
+            m_pendingTask = nullptr;
+            return true;
+        }
 
-            const auto size = file.size();
+        void setPriority(DecodePriority priority) {
+            m_priority = priority;
+        }
 
-            if (size <= 16) {
-                qInfo(cat) << "Skipping file re-render: Empty file";
+        void refresh(QGraphicsView *view) {
+            // Reloaded from scratch when it comes back into view
+            if (!m_resident) return;
+            if (m_parked) {
+                m_stale = true;
                 return;
             }
+            qInfo(cat) << "Refreshing" << m_idx;
 
-            {
-                const auto seekBack = Defer{[&] { file.seek(0); }};
-                file.seek(size - 8);
+            if (m_decoding) {
+                // Picked up by finishRefresh once the in-flight decode lands
+                m_refreshPending = true;
+                return;
+            }
 
-                if (file.read(4) != QByteArrayLiteral("\x49\x45\x4E\x44")) {
-                    qInfo(cat) << "Skipping file re-render: Missing IEND footer";
+            m_decoding = true;
+            m_bufferBytes = bufferBytes();
+            const auto reload = std::exchange(m_reload, false);
+            // Claimed by whichever comes first, the worker starting or cancelLoad
+            m_pendingLoad = reload ? std::make_shared<std::atomic<bool>>(false) : nullptr;
+            auto *task = QRunnable::create([this, view, fileName = fileName(), idx = m_idx,
+                                            previous = m_item->image(), options = decodeOptions(), reload,
+                                            claim = m_pendingLoad]() mutable {
+                if (claim && claim->exchange(true)) {
+                    QMetaObject::invokeMethod(view, [this, view] {
+                        finishRefresh(view, nullptr, 0);
+                    }, Qt::QueuedConnection);
                     return;
                 }
-            }
+                if (reload) {
+                    m_fingerprint = {};
+                    m_stream.reset();
+                }
+                QElapsedTimer timer;
+                timer.start();
+                // Moved in so the displayed frame is not still shared when it comes back as the spare
+                auto decoded = read_and_decode(fileName, idx, m_fingerprint, std::move(previous), &m_buffers,
+                                               options, m_stream);
+                QMetaObject::invokeMethod(view, [this, view, decoded, millis = timer.elapsed()] {
+                    finishRefresh(view, decoded, millis);
+                }, Qt::QueuedConnection);
+            });
+            m_pendingTask = reload ? task : nullptr;
+            decodePool->start(task, static_cast<int>(m_priority));
+        }
 
-            const auto bytesPtr = file.map(0, size);
-            const auto unmapFn = Defer{[&] { file.unmap(bytesPtr); }};
-            const auto newHash = QCryptographicHash::hash(QByteArrayView(bytesPtr, size),
-                                                          QCryptographicHash::Algorithm::Sha1);
-            if (newHash == m_hash) {
-                qInfo(cat) << "Skipping image update for" << m_idx;
+        void finishRefresh(QGraphicsView *view, const std::shared_ptr<DecodedFile> &decoded, qint64 millis) {
+            m_decoding = false;
+            m_pendingLoad.reset();
+            m_pendingTask = nullptr;
+            if (decoded) decodeMillis += (static_cast<double>(millis) - decodeMillis) / 8;
+
+            if (!m_resident) {
+                // Went out of view while decoding
+                freeBuffers();
+                m_refreshPending = false;
                 return;
             }
 
-            fetch(bytesPtr, size);
+            const auto size = boundingRect().size();
+            if (decoded) {
+                const auto [reused, allocated] = m_buffers.takeCounts();
+                qInfo(cat) << "Refresh of" << m_idx << "reused" << reused << "and allocated" << allocated
+                           << "decoder and pixel buffers," << m_buffers.totalReused << "allocations saved so far";
+
+                if (!decoded->image.isNull()) {
+                    m_buffers.spareFrame = m_item->setImage(std::move(decoded->image), std::move(decoded->mips),
+                                                            decoded->changed);
+                    qInfo(cat) << "Invalidating scene" << m_idx;
+                    view->invalidateScene(m_item->changedRect(decoded->changed), QGraphicsScene::ItemLayer);
+                }
+
+                if (!decoded->partial) {
+                    m_deep = std::move(decoded->deep);
+                    m_window = decoded->window;
+                    // The window moved while this was decoding
+                    if (decoded->window != sampleWindow) applyWindow(view);
+                }
+                qInfo(cat) << (decoded->partial ? "Partial update finished" : "Update finished") << m_idx;
+            }
+            if (boundingRect().size() != size && geometryChanged) geometryChanged(*this);
 
-            qInfo(cat) << "Invalidating scene" << m_idx;
-            view->invalidateScene(m_pixMap->boundingRect(), QGraphicsScene::ItemLayer);
+            if (std::exchange(m_refreshPending, false)) {
+                refresh(view);
+            }
+            if (m_parked && !m_decoding) freeBuffers();
+        }
 
-            m_hash = newHash;
-            qInfo(cat) << "Update finished" << m_idx;
+        // Re-maps a deep frame through the current window without decoding it again
+        void applyWindow(QGraphicsView *view) {
+            m_window = sampleWindow;
+            if (m_deep.isNull()) return;
+            auto image = apply_window(m_deep, sampleWindow);
+            auto mips = build_mips(image);
+            auto previous = m_item->setImage(std::move(image), std::move(mips));
+            // An in-flight decode may be writing to the spare frame
+            if (!m_decoding) m_buffers.spareFrame = std::move(previous);
+            view->invalidateScene(m_item->changedRect({}), QGraphicsScene::ItemLayer);
         }
 
         [[nodiscard]] QRectF boundingRect() const {
-            return m_pixMap->boundingRect();
+            return m_item->boundingRect();
         }
 
-        [[nodiscard]] QString fileName() const {
-            return makeFilename(m_idx);
+        [[nodiscard]] const QString &fileName() const {
+            return m_fileName;
         }
 
     private:
-        size_t m_idx;
-        QGraphicsPixmapItem *m_pixMap;
-        QByteArray m_hash;
-        wuffs_aux::DecodeImageResult m_store;
-    };
-
-    static std::vector<ImgState> states;
-
-    auto *watcher = new QFileSystemWatcher(window);
-    watcher->addPath(root.absolutePath());
-    const auto refreshWatchlist = [=](const QString &path) {
-        std::optional<size_t> latestWidth;
-        std::map<size_t, QStringList> validFiles;
-        auto latestWidthChange = QDateTime::fromSecsSinceEpoch(0);
-        for (width = 1; width < 4; ++width) {
-            for (int fileIdx = 1; fileIdx < static_cast<int>(std::pow(10, width)); ++fileIdx) {
-                const auto name = makeFilename(fileIdx);
-                const auto info = QFileInfo(name);
-                if (!info.exists()) break;
-                validFiles[width] << name;
-                const auto thisChange = info.lastModified();
-                if (thisChange > latestWidthChange) {
-                    latestWidthChange = thisChange;
-                    latestWidth = width;
-                }
-            }
+        // Only with no decode in flight
+        [[nodiscard]] int64_t bufferBytes() const {
+            return m_buffers.sizeInBytes() + (m_stream ? m_stream->sizeInBytes() : 0);
+        }
+
+        // The stream decodes into the pooled work buffer, so it goes first. Only with no decode in flight.
+        void freeBuffers() {
+            m_stream.reset();
+            m_buffers.clear();
         }
 
-        width = latestWidth.value_or(1);
+        size_t m_idx;
+        size_t m_slot = noSlot;
+        QString m_fileName;
+        ImageItem *m_item;
+        // Like m_buffers and m_stream, only touched by the single decode in flight
+        FileFingerprint m_fingerprint;
+        BufferPool m_buffers;
+        DeepFrame m_deep;
+        // What m_deep was last mapped through
+        SampleWindow m_window;
+        std::unique_ptr<StreamingDecode> m_stream;
+        bool m_decoding = false;
+        // bufferBytes() when the decode in flight started
+        int64_t m_bufferBytes = 0;
+        bool m_refreshPending = false;
+        DecodePriority m_priority = DecodePriority::OffScreen;
+        std::shared_ptr<std::atomic<bool>> m_pendingLoad;
+        // Owned by decodePool, only valid while m_pendingLoad is unclaimed
+        QRunnable *m_pendingTask = nullptr;
+        // Whether the frame is near enough to the viewport to hold pixels
+        bool m_resident = false;
+        bool m_reload = false;
+        // Out of view, holding on to its pixels while the memory budget allows
+        bool m_parked = false;
+        bool m_stale = false;
+        uint64_t m_lastViewed = 0;
+        QTimer m_quietTimer;
+        QElapsedTimer m_burst;
+        QGraphicsView *m_burstView = nullptr;
+        size_t m_coalesced = 0;
+    };
+
+    // Decode workers hold on to their ImgState, so elements must never move
+    static std::deque<ImgState> states;
 
-        qInfo(cat) << "Detected latest first file" << makeFilename(1) << "with width" << width;
-        qInfo(cat) << "Existing files" << validFiles[width];
+    static FrameIndex frameIndex;
+    // Every frame seen so far by absolute path, including hidden ones
+    static QHash<QString, ImgState *> stateIndex;
+    // Header probes run on the GUI thread, apart from the decode workers
+    static BufferPool probeBuffers;
+    // The frames on display, in order. A frame removed since the last full pass leaves a null slot.
+    static std::vector<ImgState *> shown;
+    static const auto pathKey = [](const QString &path) {
+        return QDir::cleanPath(root.absoluteFilePath(path));
+    };
+    auto *watcher = new DirectoryWatcher(root.absolutePath(), parser.isSet(pollOption), window);
+    watcher->isCandidate = [](const QString &name) {
+        return frame_digits(filePattern, name).has_value();
+    };
+    static ColumnLayout frameLayout(10);
+    static qreal sceneWidth = 0;
+    // Frames within a screen of the viewport hold decoded pixels, the others only their geometry, unless they
+    // are cached under the memory budget. Only the former are moved into place. Elsewhere an item may sit at a
+    // stale offset, so cached items are parked and not painted until they come back.
+    static std::vector<ImgState *> resident;
+    static std::vector<ImgState *> cached;
+    static uint64_t viewTick = 0;
+    static size_t evictions = 0;
+    // Scene rows per millisecond, positive when scrolling down
+    static qreal scrollVelocity = 0;
+    static QElapsedTimer scrollClock;
+    scrollClock.start();
+    // Set while the view scrolls itself to keep a frame in place, which is no sign of where the user is headed
+    static bool anchoring = false;
+    const auto trackScroll = [=] {
+        static qreal lastTop = 0;
+        const auto top = view->mapToScene(QPoint(0, 0)).y();
+        const auto moved = top - std::exchange(lastTop, top);
+        if (anchoring) return;
+        const auto elapsed = scrollClock.restart();
+        // A scroll after a pause starts from rest
+        const auto velocity = moved / static_cast<qreal>(std::max<qint64>(elapsed, 1));
+        scrollVelocity = elapsed >= 150 ? 0 : (scrollVelocity + velocity) / 2;
+    };
+    const auto updateResidency = [=] {
+        const auto visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+        const auto velocity = scrollClock.elapsed() < 150 ? scrollVelocity : 0.0;
+        // Far enough ahead that decodes queued now land before their frames scroll into view
+        const auto ahead = std::min(std::abs(velocity) * decodeMillis * 2, visible.height() * 8);
+        auto top = visible.top() - visible.height();
+        auto bottom = visible.bottom() + visible.height();
+        if (velocity > 0) bottom += ahead;
+        if (velocity < 0) top -= ahead;
+
+        size_t first = 0;
+        size_t last = 0;
+        std::vector<ImgState *> next;
+        ++viewTick;
+        if (!shown.empty()) {
+            first = frameLayout.indexAt(top);
+            last = frameLayout.indexAt(bottom);
+            // In the direction of the scroll, so the nearest of the queued prefetches start first
+            for (size_t at = 0; at <= last - first; ++at) {
+                const auto i = velocity < 0 ? last - at : first + at;
+                if (!shown[i]) continue;
+                shown[i]->setOffset(QPointF(0, static_cast<qreal>(frameLayout.offset(i))));
+                const auto rect = shown[i]->boundingRect();
+                const auto onScreen = rect.bottom() >= visible.top() && rect.top() <= visible.bottom();
+                const auto upcoming = velocity > 0 ? rect.top() > visible.bottom() : rect.bottom() < visible.top();
+                shown[i]->setPriority(onScreen ? DecodePriority::Visible
+                                               : velocity != 0 && upcoming ? DecodePriority::Prefetch
+                                                                           : DecodePriority::OffScreen);
+                shown[i]->load(view);
+                shown[i]->touch(viewTick);
+                next.push_back(shown[i]);
+            }
+        }
+        // Frames hidden by a rescan are dropped right away, as they may be rewritten before they come back
+        const auto near = [&](ImgState *state) {
+            const auto slot = state->slot();
+            return slot >= first && slot <= last && slot < shown.size() && shown[slot] == state;
+        };
+        cached.erase(std::remove_if(cached.begin(), cached.end(), [&](ImgState *state) {
+            if (!state->isVisible()) state->release();
+            return !state->isVisible() || near(state);
+        }), cached.end());
+        size_t cancelled = 0;
+        for (auto *state: resident) {
+            if (near(state)) continue;
+            if (state->cancelLoad()) {
+                ++cancelled;
+            } else if (state->isVisible()) {
+                state->park();
+                cached.push_back(state);
+            } else {
+                state->release();
+            }
+        }
+        resident = std::move(next);
 
-        fileCount = validFiles[width].size();
+        int64_t used = 0;
+        for (const auto *state: resident) used += state->pixelBytes();
+        const auto pinned = used;
+        for (const auto *state: cached) used += state->pixelBytes();
+        if (used > memoryBudget && !cached.empty()) {
+            std::sort(cached.begin(), cached.end(), [](const ImgState *a, const ImgState *b) {
+                return a->lastViewed() < b->lastViewed();
+            });
+            size_t evicted = 0;
+            for (; evicted < cached.size() && used > memoryBudget; ++evicted) {
+                used -= cached[evicted]->pixelBytes();
+                cached[evicted]->release();
+            }
+            cached.erase(cached.begin(), cached.begin() + static_cast<ptrdiff_t>(evicted));
+            evictions += evicted;
+            qInfo(cat) << "Evicted" << evicted << "frames," << evictions << "so far";
+        }
+        qDebug(cat) << "Decoded frames use" << (used >> 20) << "of" << (memoryBudget >> 20) << "MiB:"
+                    << resident.size() << "near the view with" << (pinned >> 20) << "MiB and" << cached.size()
+                    << "cached";
+        if (cancelled > 0 || ahead > 0) {
+            qDebug(cat) << "Prefetching" << ahead << "rows ahead at" << velocity << "rows/ms, cancelled" << cancelled
+                        << "loads";
+        }
+    };
+    // Runs change, then scrolls so that the frame at the top of the viewport stays where it was
+    const auto keepAnchor = [=](const std::function<void()> &change) {
+        const auto top = view->mapToScene(QPoint(0, 0)).y();
+        auto *anchor = shown.empty() ? nullptr : shown[frameLayout.indexAt(top)];
+        const auto within = anchor ? top - static_cast<qreal>(frameLayout.offset(anchor->slot())) : 0.0;
 
-        watcher->removePaths(watcher->files());
-        watcher->addPaths(validFiles[width]);
+        change();
+        scene->setSceneRect(QRectF(0, 0, sceneWidth, static_cast<qreal>(frameLayout.extent())));
 
-        for (size_t c = states.size(); c < fileCount; ++c) {
-            auto *item = new QGraphicsPixmapItem();
+        if (anchor && anchor->isVisible()) {
+            const auto moved = static_cast<qreal>(frameLayout.offset(anchor->slot())) + within - top;
+            auto *scrollBar = view->verticalScrollBar();
+            if (moved != 0) {
+                anchoring = true;
+                scrollBar->setValue(scrollBar->value() + qRound(moved * view->transform().m22()));
+                anchoring = false;
+            }
+        }
+        updateResidency();
+    };
+    const auto resized = [=](ImgState &state) {
+        if (!state.isVisible()) return;
+        const auto rect = state.boundingRect();
+        sceneWidth = std::max(sceneWidth, rect.width());
+        keepAnchor([&] {
+            frameLayout.setHeight(state.slot(), static_cast<int64_t>(std::ceil(rect.height())));
+        });
+    };
+    static const auto framePath = [](const QString &digits) {
+        return root.filePath(QString(filePattern).replace(QStringLiteral("{n}"), digits));
+    };
+    // The width picked by the last full pass and the last frame it showed, which new frames are appended after
+    static qsizetype shownWidth = 1;
+    static std::optional<FrameIndex::Frame> lastShown;
+    static size_t removedSlots = 0;
+    // Frames deleted since the last full pass, which may still hold a null slot
+    static std::vector<ImgState *> vacated;
+    // The state for path, created on first sight
+    const auto ensureState = [=](const FrameIndex::Frame &frame, const QString &path) {
+        auto *&state = stateIndex[pathKey(path)];
+        if (!state) {
+            auto *item = new ImageItem();
             item->setTransformationMode(Qt::SmoothTransformation);
-            auto offset = QPointF(0, 10);
-            if (!states.empty()) {
-                offset += states.at(states.size() - 1).boundingRect().bottomLeft();
-            }
-            item->setOffset(offset);
-            auto state = ImgState{c + 1, item};
-            state.fetch();
-            states.emplace_back(std::move(state));
+            state = &states.emplace_back(frame.number, path, item);
+            state->geometryChanged = resized;
             scene->addItem(item);
         }
+        return state;
+    };
+    // Sizes a frame that appeared, unless it still holds its pixels
+    const auto probeSize = [=](ImgState *state, const QString &path, const ImgState *before) {
+        if (state->isResident()) return;
+        // Laid out from the header so the whole scene is in place before any pixels arrive. A file
+        // without one yet is sized like the frame before it, so it does not pull later frames into view.
+        const auto size = probe_png_size(path, probeBuffers);
+        state->setSize(size ? *size
+                            : !before ? view->viewport()->size()
+                                      : before->boundingRect().size().toSize());
+    };
+    const auto refreshWatchlist = [=] {
+        qsizetype width = 1;
+        const auto frames = frameIndex.sequence(width);
+        qInfo(cat) << "Detected" << frames.size() << "frames with width" << width;
 
-        for (size_t c = 0; c < states.size(); ++c) {
-            states[c].setVisible(c < fileCount);
+        QElapsedTimer probing;
+        probing.start();
+        size_t probed = 0;
+        QStringList files;
+        std::vector<ImgState *> next;
+        next.reserve(frames.size());
+        for (const auto &frame: frames) {
+            const auto path = framePath(frame.digits);
+            files << path;
+            const auto known = stateIndex.value(pathKey(path), nullptr);
+            auto *state = ensureState(frame, path);
+            // New, or back after going missing
+            if (!known || !known->isVisible()) {
+                probeSize(state, path, next.empty() ? nullptr : next.back());
+                ++probed;
+            }
+            next.push_back(state);
         }
+        if (probed > 0) qInfo(cat) << "Probed" << probed << "headers in" << probing.elapsed() << "ms";
+        watcher->setFiles(files);
+
+        // Hidden frames are released by updateResidency and decoded again should they come back, as they may
+        // have been rewritten meanwhile
+        keepAnchor([&] {
+            for (auto *state: vacated) state->setSlot(noSlot);
+            vacated.clear();
+            for (auto *state: shown) {
+                if (!state) continue;
+                state->setVisible(false);
+                state->setSlot(noSlot);
+            }
+            std::vector<int64_t> heights;
+            heights.reserve(next.size());
+            for (size_t i = 0; i < next.size(); ++i) {
+                const auto rect = next[i]->boundingRect();
+                next[i]->setVisible(true);
+                next[i]->setSlot(i);
+                heights.push_back(static_cast<int64_t>(std::ceil(rect.height())));
+                sceneWidth = std::max(sceneWidth, rect.width());
+            }
+            shown = std::move(next);
+            frameLayout.assign(std::move(heights));
+        });
+        shownWidth = width;
+        lastShown = frames.empty() ? std::nullopt : std::optional<FrameIndex::Frame>(frames.back());
+        removedSlots = 0;
     };
-    QWidget::connect(watcher, &QFileSystemWatcher::directoryChanged, refreshWatchlist);
+    // Applies one entry to the frames on display without going over the others. False when it takes a full
+    // pass: a file of another width may change the width picked, and only appends and frames coming back to the
+    // slot they left keep the slots in order.
+    const auto applyEntry = [=](const FrameIndex::Frame &frame, bool exists) {
+        if (!frame.hasWidth(shownWidth)) return false;
+        const auto path = framePath(frame.digits);
+        auto *state = stateIndex.value(pathKey(path), nullptr);
+        const auto onDisplay = state && state->isVisible();
+        if (exists == onDisplay) return true;
+
+        if (!exists) {
+            watcher->unwatchFile(path);
+            keepAnchor([&] {
+                frameLayout.remove(state->slot());
+                shown[state->slot()] = nullptr;
+                state->setVisible(false);
+            });
+            vacated.push_back(state);
+            ++removedSlots;
+            return true;
+        }
+
+        // Back in the null slot it left when deleted, sized like it was until its header is there
+        if (const auto slot = state ? state->slot() : noSlot; slot < shown.size() && !shown[slot]) {
+            probeSize(state, path, state);
+            keepAnchor([&] {
+                const auto rect = state->boundingRect();
+                state->setVisible(true);
+                shown[slot] = state;
+                frameLayout.setHeight(slot, static_cast<int64_t>(std::ceil(rect.height())));
+                sceneWidth = std::max(sceneWidth, rect.width());
+            });
+            --removedSlots;
+            watcher->watchFile(path);
+            return true;
+        }
 
-    QWidget::connect(watcher, &QFileSystemWatcher::fileChanged, [=](const QString &path) {
-        for (qsizetype i = 1; i <= fileCount; ++i) {
-            if (QFileInfo(path).absoluteFilePath() == QFileInfo(makeFilename(i)).absoluteFilePath()) {
-                states[i - 1].refresh(view);
+        if (lastShown && !(*lastShown < frame)) return false;
+        state = ensureState(frame, path);
+        probeSize(state, path, shown.empty() ? nullptr : shown.back());
+        keepAnchor([&] {
+            const auto rect = state->boundingRect();
+            state->setVisible(true);
+            state->setSlot(shown.size());
+            shown.push_back(state);
+            frameLayout.append(static_cast<int64_t>(std::ceil(rect.height())));
+            sceneWidth = std::max(sceneWidth, rect.width());
+        });
+        lastShown = frame;
+        watcher->watchFile(path);
+        return true;
+    };
+    const auto rescan = [=] {
+        frameIndex.rebuild(root, filePattern);
+        refreshWatchlist();
+    };
+    watcher->directoryChanged = rescan;
+    watcher->entriesChanged = [=](const QStringList &names) {
+        std::vector<std::pair<FrameIndex::Frame, bool>> changes;
+        for (const auto &name: names) {
+            if (auto change = frameIndex.update(root, filePattern, name)) changes.push_back(std::move(*change));
+        }
+        QElapsedTimer timer;
+        timer.start();
+        for (const auto &[frame, exists]: changes) {
+            if (!applyEntry(frame, exists)) {
+                refreshWatchlist();
+                return;
             }
         }
-    });
+        // Compacts the slots of removed frames once they make up half of the layout
+        if (removedSlots > shown.size() / 2) {
+            refreshWatchlist();
+            return;
+        }
+        qDebug(cat) << "Applied" << changes.size() << "entries in" << timer.nsecsElapsed() << "ns";
+    };
+
+    const auto stateFor = [](const QString &path) -> ImgState * {
+        QElapsedTimer timer;
+        timer.start();
+        auto *state = stateIndex.value(pathKey(path), nullptr);
+        qDebug(cat) << "Dispatched" << path << "in" << timer.nsecsElapsed() << "ns";
+        return state;
+    };
+
+    watcher->fileChanged = [=](const QString &path) {
+        if (auto *state = stateFor(path)) state->scheduleRefresh(view);
+    };
+
+    watcher->fileWritten = [=](const QString &path) {
+        // Keeps the modification times that pick the frame number width current
+        frameIndex.update(root, filePattern, QFileInfo(path).fileName());
+        if (auto *state = stateFor(path)) state->refreshNow(view);
+    };
 
-    auto *zoomIn = new QAction(view);
+    watcher->eventsLost = [=] {
+        // Creates and deletes were dropped too, and only events keep the index current
+        rescan();
+        for (auto *state: shown) {
+            if (state) state->scheduleRefresh(view);
+        }
+    };
+
+    auto *zoomIn = new QAction(QStringLiteral("Zoom in"), view);
     zoomIn->setShortcut(Qt::Key_Equal);
     QWidget::connect(zoomIn, &QAction::triggered, [=] {
         view->scale(1.1, 1.1);
+        updateResidency();
     });
 
-    auto *zoomOut = new QAction(view);
+    auto *zoomOut = new QAction(QStringLiteral("Zoom out"), view);
     zoomOut->setShortcut(Qt::Key_Minus);
     QWidget::connect(zoomOut, &QAction::triggered, [=] {
         view->scale(1.0 / 1.1, 1.0 / 1.1);
+        updateResidency();
     });
 
     auto *quit = new QAction(window);
     quit->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_Q));
     QWidget::connect(quit, &QAction::triggered, window, &QMainWindow::close);
 
-    auto *reload = new QAction(window);
+    auto *reload = new QAction(QStringLiteral("Reload"), window);
     reload->setShortcut(QKeySequence(Qt::Key_R));
-    QWidget::connect(reload, &QAction::triggered, [&] { refreshWatchlist(root.path()); });
+    QWidget::connect(reload, &QAction::triggered, rescan);
+
+    auto *trustChecksums = new QAction(QStringLiteral("Skip checksum verification"), view);
+    trustChecksums->setCheckable(true);
+    trustChecksums->setChecked(ignoreChecksum);
+    trustChecksums->setShortcut(Qt::Key_T);
+    QWidget::connect(trustChecksums, &QAction::toggled, [](bool checked) {
+        ignoreChecksum = checked;
+        qInfo(cat) << "Checksum verification" << (ignoreChecksum ? "disabled" : "enabled");
+    });
+
+    const auto setSampleWindow = [=](SampleWindow next) {
+        sampleWindow = next;
+        QElapsedTimer timer;
+        timer.start();
+        // Cached frames catch up once they come back into view
+        for (auto *state: resident) state->applyWindow(view);
+        qInfo(cat) << "Window" << sampleWindow.low << "to" << sampleWindow.high << "applied in"
+                   << timer.nsecsElapsed() / 1000000.0 << "ms";
+    };
+
+    auto *raiseWindow = new QAction(QStringLiteral("Raise window"), view);
+    raiseWindow->setShortcut(Qt::Key_BracketRight);
+    QWidget::connect(raiseWindow, &QAction::triggered, [=] { setSampleWindow(sampleWindow.shifted(1)); });
+
+    auto *lowerWindow = new QAction(QStringLiteral("Lower window"), view);
+    lowerWindow->setShortcut(Qt::Key_BracketLeft);
+    QWidget::connect(lowerWindow, &QAction::triggered, [=] { setSampleWindow(sampleWindow.shifted(-1)); });
+
+    auto *widenWindow = new QAction(QStringLiteral("Widen window"), view);
+    widenWindow->setShortcut(Qt::Key_BraceRight);
+    QWidget::connect(widenWindow, &QAction::triggered, [=] { setSampleWindow(sampleWindow.scaled(2.0)); });
+
+    auto *narrowWindow = new QAction(QStringLiteral("Narrow window"), view);
+    narrowWindow->setShortcut(Qt::Key_BraceLeft);
+    QWidget::connect(narrowWindow, &QAction::triggered, [=] { setSampleWindow(sampleWindow.scaled(0.5)); });
+
+    auto *resetWindow = new QAction(QStringLiteral("Reset window"), view);
+    resetWindow->setShortcut(Qt::Key_Backslash);
+    QWidget::connect(resetWindow, &QAction::triggered, [=] { setSampleWindow({}); });
 
     view->addAction(zoomIn);
     view->addAction(zoomOut);
     view->addAction(reload);
+    view->addAction(trustChecksums);
+    if (keepDeepSamples) {
+        view->addAction(raiseWindow);
+        view->addAction(lowerWindow);
+        view->addAction(widenWindow);
+        view->addAction(narrowWindow);
+        view->addAction(resetWindow);
+    }
+    view->setContextMenuPolicy(Qt::ActionsContextMenu);
+
+    // Resizing the window changes the scroll range
+    QWidget::connect(view->verticalScrollBar(), &QScrollBar::valueChanged, [=] {
+        trackScroll();
+        updateResidency();
+    });
+    QWidget::connect(view->verticalScrollBar(), &QScrollBar::rangeChanged, updateResidency);
 
     window->addAction(quit);
     window->setCentralWidget(view);
     window->show();
-    refreshWatchlist(root.path());
+    rescan();
+
+    const auto drainDecodes = Defer{[] {
+        decodePool->clear();
+        decodePool->waitForDone();
+    }};
     return QCoreApplication::exec();
 }